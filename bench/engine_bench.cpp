@@ -0,0 +1,422 @@
+// Headless benchmark for engine.hpp. Builds synthetic trees, runs them for a number of frames
+// against a null renderer and prints one JSON document with per-phase timings, effect runs and
+// heap allocations per frame, for tracking regressions between builds.
+//
+//   engine_bench [--frames N] [--warmup N] [--scene chain|fanout|entities|derived|churn]
+//                [--size N] [--rollback] [--view]
+//
+// --rollback captures the tree's state before every frame and restores it afterwards, like a
+// rollback client resimulating one frame, and adds the snapshot and restore timings. Each
+// capture builds on the previous one and is checked against a full capture; the churn scene,
+// whose shape changes every frame, only runs that check since a restore can't cross it.
+//
+// --view renders through an explicit VIEW_WIDTH x VIEW_HEIGHT view instead, so nodes with
+// bounds that miss it are culled. The null renderer has no output size to derive one from.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "engine.hpp"
+
+//------------------------------------------------------------------------------
+// Counters
+//------------------------------------------------------------------------------
+// Defined in allocation_counter.cpp, which replaces the global operator new.
+uint64_t heapAllocationCount();
+// Incremented by the effects the scenes register.
+static uint64_t effectRuns = 0;
+
+//------------------------------------------------------------------------------
+// Scenes
+//------------------------------------------------------------------------------
+constexpr double STEP_SECONDS = 1.0 / 120.0;
+constexpr float VIEW_WIDTH = 800.0f;
+constexpr float VIEW_HEIGHT = 600.0f;
+
+static SDL_FRect rectAt(float x, float y) {
+    return {x, y, 4.0f, 4.0f};
+}
+
+// `depth` nested nodes. The root's update writes a counter every frame and each level's effect
+// copies its parent's value into its own state, so one write ripples down the whole chain.
+static NodePtr ChainScene(size_t depth) {
+    auto root = createNode();
+    auto tick = root->state(0);
+    root->update([tick](double) mutable { tick.set(tick.get() + 1); });
+
+    Node* parent = root.get();
+    State<int> parentValue = tick;
+    for (size_t level = 0; level < depth; ++level) {
+        auto node = createNode();
+        auto value = node->state(0);
+        node->effect(
+            [parentValue, value]() mutable {
+                ++effectRuns;
+                value.set(parentValue.get());
+            },
+            parentValue
+        );
+        float y = static_cast<float>(level);
+        node->render(
+            [value, y](SDL_Renderer* renderer) {
+                SDL_Color color = {uint8_t(value.get()), 0, 0, 255};
+                drawFillRect(renderer, color, rectAt(0.0f, y));
+            },
+            value
+        );
+        Node* next = node.get();
+        parent->AddChild(node);
+        parent = next;
+        parentValue = value;
+    }
+    return root;
+}
+
+// `width` siblings, each integrating its own position, drawing every frame and listening for
+// a key, plus an effect on a shared state that the root flips every 60 frames.
+static NodePtr FanoutScene(size_t width) {
+    auto root = createNode();
+    auto phase = root->state(false);
+    root->update([phase, frame = 0](double) mutable {
+        if (++frame % 60 == 0) {
+            phase.set(!phase.get());
+        }
+    });
+
+    for (size_t i = 0; i < width; ++i) {
+        auto child = createNode();
+        auto x = child->state(static_cast<float>(i));
+        child->update([x](double dt) mutable { x.set(x.get() + static_cast<float>(dt)); });
+        child->render([x](SDL_Renderer* renderer) {
+            drawFillRect(renderer, SDL_Color{0, 255, 0, 255}, rectAt(x.get(), 0.0f));
+        });
+        child->effect([]() { ++effectRuns; }, phase);
+        child->onKey(SDL_SCANCODE_SPACE, [x](SDL_Event*) mutable { x.set(0.0f); });
+        root->AddChild(child);
+    }
+    return root;
+}
+
+// `count` entities in one Batch, drawn by a keyed list of nodes with bounds and cached
+// renders, moved every frame in one pass over the column. The same shape as the game's pipes.
+// They are spread over five view widths, so --view culls most of them.
+static NodePtr EntitiesScene(size_t count) {
+    auto root = createNode();
+    auto entities = root->batch<float, float>();
+    const float spacing = VIEW_WIDTH * 5.0f / static_cast<float>(std::max<size_t>(count, 1));
+    for (size_t i = 0; i < count; ++i) {
+        entities->add(static_cast<float>(i) * spacing, static_cast<float>(i % 600));
+    }
+
+    root->AddChild(For(
+        entities->ids(),
+        [](BatchId id) { return id; },
+        [entities](State<BatchId> id) {
+            auto node = createNode();
+            node->bounds(
+                [entities, id]() {
+                    size_t index = entities->indexOf(id.get());
+                    return rectAt(entities->column<0>()[index], entities->column<1>()[index]);
+                },
+                id,
+                entities->revision()
+            );
+            node->render(
+                [entities, id](SDL_Renderer* renderer) {
+                    size_t index = entities->indexOf(id.get());
+                    SDL_FRect rect = rectAt(
+                        entities->column<0>()[index],
+                        entities->column<1>()[index]
+                    );
+                    drawFillRect(renderer, SDL_Color{0, 255, 0, 255}, rect);
+                },
+                id,
+                entities->revision()
+            );
+            return node;
+        }
+    ));
+
+    root->update([entities](double dt) {
+        for (float& x : entities->column<0>()) {
+            x -= static_cast<float>(dt);
+        }
+        entities->markChanged();
+    });
+    root->effect([]() { ++effectRuns; }, entities->revision());
+    return root;
+}
+
+constexpr size_t DERIVED_CHAIN_LENGTH = 8;
+
+// `chains` derived chains of DERIVED_CHAIN_LENGTH links hanging off one source that the root
+// writes every frame, each ending in an effect.
+static NodePtr DerivedScene(size_t chains) {
+    auto root = createNode();
+    auto source = root->state(0);
+    root->update([source](double) mutable { source.set(source.get() + 1); });
+
+    for (size_t chain = 0; chain < chains; ++chain) {
+        auto node = createNode();
+        State<int> link = source;
+        for (size_t i = 0; i < DERIVED_CHAIN_LENGTH; ++i) {
+            link = node->derived([link]() { return link.get() + 1; }, link);
+        }
+        node->effect([]() { ++effectRuns; }, link);
+        root->AddChild(node);
+    }
+    return root;
+}
+
+// `count` leaves, one of them replaced by a fresh node every frame, so node and slot memory is
+// freed and reused constantly. The same churn as respawning entities without recycling.
+static NodePtr ChurnScene(size_t count) {
+    auto root = createNode();
+    auto tick = root->state(0);
+    root->update([tick](double) mutable { tick.set(tick.get() + 1); });
+
+    // State only: nodes with hooks are held by the phase lists until the next rebuild, which
+    // would delay reuse of their memory by a frame
+    auto leaf = [](int value) {
+        auto node = createNode();
+        node->state(value);
+        return node;
+    };
+    for (size_t i = 0; i < count; ++i) {
+        root->AddChild(leaf(static_cast<int>(i)));
+    }
+    // Replace the first leaf, freeing the old one before building the new one, so the new slot
+    // lands at the same tree position and usually the same address
+    root->effect(
+        [node = root.get(), tick, leaf, children = std::vector<NodePtr>{}]() mutable {
+            ++effectRuns;
+            children = node->children;
+            NodePtr& replaced = children.front();
+            replaced = nullptr;
+            node->SetChildren(children);  // Drops the old leaf
+            replaced = leaf(tick.get());
+            node->SetChildren(children);
+            children.clear();
+        },
+        tick
+    );
+    return root;
+}
+
+//------------------------------------------------------------------------------
+// Runner
+//------------------------------------------------------------------------------
+struct SceneSpec {
+    const char* name;
+    NodePtr (*build)(size_t);
+    size_t defaultSize;
+    bool changesShape = false;  // Every frame, so --rollback can't restore across it
+};
+
+constexpr SceneSpec SCENES[] = {
+    {"chain", ChainScene, 256},
+    {"fanout", FanoutScene, 1000},
+    {"entities", EntitiesScene, 1000},
+    {"derived", DerivedScene, 256},
+    {"churn", ChurnScene, 1000, true},
+};
+
+struct PhaseTimes {
+    std::vector<double> ns;
+
+    double percentile(double p) const {
+        if (ns.empty()) {
+            return 0.0;
+        }
+        std::vector<double> sorted = ns;
+        std::sort(sorted.begin(), sorted.end());
+        size_t index = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+        return sorted[index];
+    }
+
+    double mean() const {
+        double total = 0.0;
+        for (double value : ns) {
+            total += value;
+        }
+        return ns.empty() ? 0.0 : total / static_cast<double>(ns.size());
+    }
+};
+
+static size_t countNodes(const Node& node) {
+    size_t count = 1;
+    for (const NodePtr& child : node.children) {
+        count += countNodes(*child);
+    }
+    return count;
+}
+
+template <typename Fn>
+static double timeNs(Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+static void printPhase(const char* name, const PhaseTimes& times) {
+    std::printf(
+        "\"%s_ns\": {\"mean\": %.1f, \"median\": %.1f, \"p99\": %.1f}",
+        name,
+        times.mean(),
+        times.percentile(0.5),
+        times.percentile(0.99)
+    );
+}
+
+static void runScene(
+    const SceneSpec& spec,
+    size_t size,
+    int frames,
+    int warmup,
+    bool rollback,
+    bool useView,
+    bool first
+) {
+    NodePtr root = spec.build(size);
+    SDL_Renderer* renderer = nullptr;  // Draw calls are recorded and flushed, then dropped
+    SDL_Event key{};
+    key.type = SDL_EVENT_KEY_DOWN;
+    key.key.scancode = SDL_SCANCODE_SPACE;
+
+    PhaseTimes update;
+    PhaseTimes render;
+    PhaseTimes event;
+    PhaseTimes snapshot;
+    PhaseTimes restore;
+    StateSnapshot snapshots[2];  // This frame's and the last one, which the capture builds on
+    StateSnapshot fullCapture;   // Reference for checking the incremental one
+    uint64_t measuredEffectRuns = 0;
+    uint64_t measuredAllocations = 0;
+    for (int frame = 0; frame < warmup + frames; ++frame) {
+        const bool measured = frame >= warmup;
+        const uint64_t effectsBefore = effectRuns;
+        const uint64_t allocationsBefore = heapAllocationCount();
+
+        StateSnapshot& current = snapshots[frame % 2];
+        double snapshotNs = 0.0;
+        if (rollback) {
+            snapshotNs = timeNs([&] { captureState(root, current, &snapshots[(frame + 1) % 2]); });
+            captureState(root, fullCapture);
+            if (fullCapture.bytes != current.bytes) {
+                std::fprintf(
+                    stderr, "engine_bench: %s snapshot differs at frame %d\n", spec.name, frame
+                );
+                std::exit(1);
+            }
+        }
+        double eventNs = timeNs([&] { eventTree(root, &key); });
+        double updateNs = timeNs([&] { updateTree(root, STEP_SECONDS); });
+        double renderNs = timeNs([&] {
+            if (useView) {
+                renderTree(root, renderer, SDL_FRect{0.0f, 0.0f, VIEW_WIDTH, VIEW_HEIGHT});
+            } else {
+                renderTree(root, renderer);
+            }
+        });
+        double restoreNs = 0.0;
+        if (rollback && !spec.changesShape) {
+            restoreNs = timeNs([&] { restoreState(root, current); });
+        }
+
+        if (measured) {
+            event.ns.push_back(eventNs);
+            update.ns.push_back(updateNs);
+            render.ns.push_back(renderNs);
+            if (rollback) {
+                snapshot.ns.push_back(snapshotNs);
+                if (!spec.changesShape) {
+                    restore.ns.push_back(restoreNs);
+                }
+            }
+            measuredEffectRuns += effectRuns - effectsBefore;
+            measuredAllocations += heapAllocationCount() - allocationsBefore;
+        }
+    }
+
+    const double perFrame = frames > 0 ? 1.0 / frames : 0.0;
+    std::printf("%s    {\"scene\": \"%s\", \"size\": %zu, ", first ? "" : ",\n", spec.name, size);
+    std::printf("\"nodes\": %zu, \"view\": %s, ", countNodes(*root), useView ? "true" : "false");
+    printPhase("update", update);
+    std::printf(", ");
+    printPhase("render", render);
+    std::printf(", ");
+    printPhase("event", event);
+    if (rollback) {
+        std::printf(", ");
+        printPhase("snapshot", snapshot);
+        if (!spec.changesShape) {
+            std::printf(", ");
+            printPhase("restore", restore);
+        }
+        std::printf(", \"snapshot_bytes\": %zu", snapshots[0].bytes.size());
+    }
+    std::printf(
+        ", \"effect_runs_per_frame\": %.2f, \"allocations_per_frame\": %.2f}",
+        static_cast<double>(measuredEffectRuns) * perFrame,
+        static_cast<double>(measuredAllocations) * perFrame
+    );
+}
+
+static void usage() {
+    std::fprintf(
+        stderr,
+        "usage: engine_bench [--frames N] [--warmup N] "
+        "[--scene chain|fanout|entities|derived|churn] [--size N] [--rollback] [--view]\n"
+    );
+}
+
+int main(int argc, char** argv) {
+    int frames = 1000;
+    int warmup = 100;
+    const char* onlyScene = nullptr;
+    size_t size = 0;  // 0 means each scene's default
+    bool rollback = false;
+    bool useView = false;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--frames") && hasValue) {
+            frames = std::max(1, std::atoi(argv[++i]));
+        } else if (!std::strcmp(argv[i], "--warmup") && hasValue) {
+            warmup = std::max(0, std::atoi(argv[++i]));
+        } else if (!std::strcmp(argv[i], "--scene") && hasValue) {
+            onlyScene = argv[++i];
+        } else if (!std::strcmp(argv[i], "--size") && hasValue) {
+            size = static_cast<size_t>(std::strtoull(argv[++i], nullptr, 10));
+        } else if (!std::strcmp(argv[i], "--rollback")) {
+            rollback = true;
+        } else if (!std::strcmp(argv[i], "--view")) {
+            useView = true;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    bool matched = false;
+    std::printf("{\n  \"frames\": %d,\n  \"warmup\": %d,\n  \"results\": [\n", frames, warmup);
+    for (const SceneSpec& spec : SCENES) {
+        if (onlyScene && std::strcmp(onlyScene, spec.name) != 0) {
+            continue;
+        }
+        const size_t sceneSize = size ? size : spec.defaultSize;
+        runScene(spec, sceneSize, frames, warmup, rollback, useView, !matched);
+        matched = true;
+    }
+    std::printf("\n  ]\n}\n");
+    if (!matched) {
+        std::fprintf(stderr, "engine_bench: unknown scene '%s'\n", onlyScene);
+        return 1;
+    }
+    return 0;
+}
@@ -7,8 +7,10 @@
 struct AppState {
     SDL_Window* window = nullptr;
     SDL_Renderer* renderer = nullptr;
-    TTF_Font* font = nullptr;
+    WorkStealingPool pool{1};  // Background loads only; the update stays on the main thread
+    std::unique_ptr<ResourceCache> resources;
     NodePtr root;
+    FixedStepLoop loop{SIMULATION_STEPS_PER_SECOND, MAX_SIMULATION_STEPS_PER_FRAME};
     Uint64 lastTime = 0;
 };
 
@@ -44,16 +46,14 @@ SDL_AppResult SDL_AppInit(void** appstate, int, char*[]) {
         return SDL_APP_FAILURE;
     }
 
-    as->font = TTF_OpenFont("assets/arial.ttf", 24);
-    if (!as->font) {
-        SDL_LogWarn(
-            SDL_LOG_CATEGORY_APPLICATION,
-            "Failed to load font 'assets/arial.ttf': %s. UI text will not appear.",
-            SDL_GetError()
-        );
+    // Let the display pace frames instead of spinning; cap the callback rate if it can't
+    if (!SDL_SetRenderVSync(as->renderer, 1)) {
+        SDL_SetHint(SDL_HINT_MAIN_CALLBACK_RATE, "120");
     }
 
-    as->root = Game(as->font);
+    // Assets load on the pool while the first frames run
+    as->resources = std::make_unique<ResourceCache>(as->pool, as->renderer);
+    as->root = Game();
     as->lastTime = SDL_GetPerformanceCounter();
     return SDL_APP_CONTINUE;
 }
@@ -61,20 +61,19 @@ SDL_AppResult SDL_AppInit(void** appstate, int, char*[]) {
 SDL_AppResult SDL_AppIterate(void* appstate) {
     auto* as = (AppState*)appstate;
     Uint64 now = SDL_GetPerformanceCounter();
-    double dt = (now - as->lastTime) / (double)SDL_GetPerformanceFrequency();
-    if (dt > 0.1) {
-        dt = 0.1;
-    }
+    double elapsed = (now - as->lastTime) / (double)SDL_GetPerformanceFrequency();
     as->lastTime = now;
 
+    as->resources->poll();
+    as->loop.advance(as->root, elapsed);
+
     SDL_SetRenderDrawColor(as->renderer, 135, 206, 235, 255);  // Sky blue
     SDL_RenderClear(as->renderer);
 
-    updateTree(as->root, dt);
-    renderTree(as->root, as->renderer);
+    renderTree(as->root, as->renderer, as->loop.alpha());
 
     SDL_RenderPresent(as->renderer);
-    SDL_Delay(1);
+    Profiling::endFrame();
     return SDL_APP_CONTINUE;
 }
 
@@ -85,7 +84,7 @@ SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* e) {
     }
 
     if (as->root) {
-        eventTree(as->root, e);
+        eventTree(as->root, e, as->renderer);
     }
     return SDL_APP_CONTINUE;
 }
@@ -93,10 +92,9 @@ SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* e) {
 void SDL_AppQuit(void* appstate, SDL_AppResult /* result */) {
     if (appstate) {
         auto* as = (AppState*)appstate;
-        if (as->font) {
-            TTF_CloseFont(as->font);
-        }
         as->root.reset();
+        as->resources.reset();  // Closes the font and anything else still cached
+        ReleaseTextCaches();
 
         SDL_DestroyRenderer(as->renderer);
         SDL_DestroyWindow(as->window);
@@ -3,50 +3,60 @@
 //------------------------------------------------------------------------------
 // Bird Component
 //------------------------------------------------------------------------------
-NodePtr Bird(State<GameStatus> gameStatus, State<SDL_FRect> birdRect) {
+NodePtr Bird(State<SDL_FRect> birdRect) {
     auto node = createNode();
+    node->setProfileLabel("Bird");
+    auto gameStatus = node->use<GameStatus>();
 
     auto yPosState = node->state(WINDOW_HEIGHT / 2.0f);
+    auto prevYPosState = node->state(WINDOW_HEIGHT / 2.0f);  // At the previous step, for drawing
     auto yVelState = node->state(0.0f);
     auto rotationState = node->state(0.0f);
 
-    node->event([yVelState, gameStatus](SDL_Event* e) mutable {
-        if (e->type == SDL_EVENT_KEY_DOWN) {
-            if (e->key.scancode == SDL_SCANCODE_SPACE || e->key.scancode == SDL_SCANCODE_UP) {
-                GameStatus currentStatus = gameStatus.get();
-                if (currentStatus == GameStatus::Playing) {
-                    yVelState.set(FLAP_VELOCITY);
-                }
-            }
+    auto flap = [yVelState, gameStatus](SDL_Event*) mutable {
+        if (gameStatus.get() == GameStatus::Playing) {
+            yVelState.set(FLAP_VELOCITY);
         }
-    });
+    };
+    node->onKey(SDL_SCANCODE_SPACE, flap);
+    node->onKey(SDL_SCANCODE_UP, std::move(flap));
 
-    node->effect(
-        [yPosState, yVelState, rotationState, gameStatus, birdRect]() mutable {
+    node->trackedEffect(
+        [yPosState, prevYPosState, yVelState, rotationState, gameStatus, birdRect]() mutable {
             GameStatus currentStatus = gameStatus.get();
             if (currentStatus == GameStatus::MainMenu || currentStatus == GameStatus::GameOver) {
                 // Reset bird position and physics for MainMenu or GameOver
                 float initialYPos = WINDOW_HEIGHT / 2.0f;
-                yPosState.set(initialYPos);
-                yVelState.set(0.0f);
-                rotationState.set(0.0f);
-                birdRect.set({
-                    BIRD_X_POSITION - BIRD_WIDTH / 2,
-                    initialYPos - BIRD_HEIGHT / 2,
-                    BIRD_WIDTH,
-                    BIRD_HEIGHT,
+                batch([&] {
+                    yPosState.set(initialYPos);
+                    prevYPosState.set(initialYPos);
+                    yVelState.set(0.0f);
+                    rotationState.set(0.0f);
+                    birdRect.set({
+                        BIRD_X_POSITION - BIRD_WIDTH / 2,
+                        initialYPos - BIRD_HEIGHT / 2,
+                        BIRD_WIDTH,
+                        BIRD_HEIGHT,
+                    });
                 });
             }
-        },
-        gameStatus
+        }
     );
 
-    node->update([yPosState, yVelState, rotationState, gameStatus, birdRect](double dt) mutable {
+    node->update([yPosState, prevYPosState, yVelState, rotationState, gameStatus, birdRect](
+                     double dt
+                 ) mutable {
         GameStatus currentStatus = gameStatus.get();
 
-        if (currentStatus == GameStatus::Playing) {
+        if (currentStatus != GameStatus::Playing) {
+            return;
+        }
+
+        // One transaction, so the bird's dependents see the whole step at once
+        batch([&] {
             float yVel = yVelState.get();
             float yPos = yPosState.get();
+            prevYPosState.set(yPos);
 
             yVel += GRAVITY * static_cast<float>(dt);
             yPos += yVel * static_cast<float>(dt);
@@ -76,18 +86,22 @@ NodePtr Bird(State<GameStatus> gameStatus, State<SDL_FRect> birdRect) {
             if (yPos + BIRD_HEIGHT / 2 > WINDOW_HEIGHT || yPos - BIRD_HEIGHT / 2 < 0) {
                 gameStatus.set(GameStatus::GameOver);
             }
-        }
+        });
     });
 
-    node->render([yPosState, rotationState](SDL_Renderer* renderer) {
+    // Drawn between the last two steps, so motion stays smooth when frames and fixed
+    // simulation steps don't line up
+    node->render([yPosState, prevYPosState](SDL_Renderer* renderer) {
+        float alpha = static_cast<float>(renderAlpha());
+        float yPos = prevYPosState.get() + (yPosState.get() - prevYPosState.get()) * alpha;
         SDL_FRect bird_render_rect = {
             BIRD_X_POSITION - BIRD_WIDTH / 2,
-            yPosState.get() - BIRD_HEIGHT / 2,
+            yPos - BIRD_HEIGHT / 2,
             BIRD_WIDTH,
             BIRD_HEIGHT
         };
-        SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);  // Yellow
-        SDL_RenderFillRect(renderer, &bird_render_rect);
+        SDL_Color yellow = {255, 255, 0, 255};
+        drawFillRect(renderer, yellow, bird_render_rect, RENDER_LAYER_BIRD);
     });
 
     return node;
@@ -1,4 +1,4 @@
 #pragma once
 #include "game.hpp"
 
-NodePtr Bird(State<GameStatus> status, State<SDL_FRect> birdRect);
+NodePtr Bird(State<SDL_FRect> birdRect);  // Uses the provided GameStatus
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "engine.hpp"
+
+//------------------------------------------------------------------------------
+// Collision World
+//------------------------------------------------------------------------------
+using ColliderId = uint32_t;
+
+// Two colliders that overlap, lower id first.
+struct Contact {
+    ColliderId a;
+    ColliderId b;
+
+    bool operator==(const Contact&) const = default;
+};
+
+// Axis-aligned boxes stored as separate min/max columns, so the narrow phase and queries are
+// branchless loops the compiler can vectorize. step() bins every box into a uniform grid sized
+// to the current extent of the world and only tests boxes that share a cell, then publishes the
+// overlapping pairs through contacts(). That state only changes when the set of pairs does, so
+// effects on it fire on contact begin and end rather than every frame.
+//
+// A pair is tested only if each collider's layer is in the other's mask.
+class CollisionWorld {
+  public:
+    CollisionWorld(Node& owner, float cellSize)
+        : _cellSize(cellSize)
+        , _contacts(owner.state(std::vector<Contact>{})) {
+        if (!(cellSize > 0.0f)) {
+            throw std::runtime_error("CollisionWorld: cell size must be positive");
+        }
+    }
+
+    ColliderId add(const SDL_FRect& rect, uint32_t layer = 1, uint32_t mask = UINT32_MAX) {
+        ColliderId id;
+        if (!_freeIds.empty()) {
+            id = _freeIds.back();
+            _freeIds.pop_back();
+        } else {
+            id = static_cast<ColliderId>(_denseIndex.size());
+            _denseIndex.push_back(NO_INDEX);
+        }
+        _denseIndex[id] = static_cast<uint32_t>(_ids.size());
+        _ids.push_back(id);
+        _minX.push_back(rect.x);
+        _minY.push_back(rect.y);
+        _maxX.push_back(rect.x + rect.w);
+        _maxY.push_back(rect.y + rect.h);
+        _layer.push_back(layer);
+        _mask.push_back(mask);
+        return id;
+    }
+
+    void remove(ColliderId id) {
+        if (!contains(id)) {
+            return;
+        }
+        const uint32_t index = _denseIndex[id];
+        const uint32_t last = static_cast<uint32_t>(_ids.size() - 1);
+        const ColliderId moved = _ids[last];
+        auto swapRemove = [&](auto& column) {
+            column[index] = column[last];
+            column.pop_back();
+        };
+        swapRemove(_ids);
+        swapRemove(_minX);
+        swapRemove(_minY);
+        swapRemove(_maxX);
+        swapRemove(_maxY);
+        swapRemove(_layer);
+        swapRemove(_mask);
+        _denseIndex[moved] = index;
+        _denseIndex[id] = NO_INDEX;
+        _freeIds.push_back(id);
+    }
+
+    bool contains(ColliderId id) const {
+        return id < _denseIndex.size() && _denseIndex[id] != NO_INDEX;
+    }
+
+    size_t size() const {
+        return _ids.size();
+    }
+
+    void setRect(ColliderId id, const SDL_FRect& rect) {
+        if (!contains(id)) {
+            return;
+        }
+        const uint32_t index = _denseIndex[id];
+        _minX[index] = rect.x;
+        _minY[index] = rect.y;
+        _maxX[index] = rect.x + rect.w;
+        _maxY[index] = rect.y + rect.h;
+    }
+
+    // Every collider overlapping `rect` whose layer is in `mask`, in no particular order.
+    void query(const SDL_FRect& rect, uint32_t mask, std::vector<ColliderId>& out) {
+        const float minX = rect.x;
+        const float minY = rect.y;
+        const float maxX = rect.x + rect.w;
+        const float maxY = rect.y + rect.h;
+        const size_t count = _ids.size();
+        _hits.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            _hits[i] = (_minX[i] < maxX) & (_maxX[i] > minX) & (_minY[i] < maxY) &
+                       (_maxY[i] > minY) & ((_layer[i] & mask) != 0);
+        }
+        out.clear();
+        for (size_t i = 0; i < count; ++i) {
+            if (_hits[i]) {
+                out.push_back(_ids[i]);
+            }
+        }
+    }
+
+    // Finds every overlapping pair and updates contacts() if the set changed.
+    void step() {
+        _pairs.clear();
+        const size_t count = _ids.size();
+        if (count > 1) {
+            binIntoGrid();
+            findPairs();
+        }
+        std::sort(_pairs.begin(), _pairs.end(), [](const Contact& x, const Contact& y) {
+            return x.a != y.a ? x.a < y.a : x.b < y.b;
+        });
+        if (_pairs != _contacts.peek()) {
+            _contacts.set(_pairs);
+        }
+    }
+
+    // Pairs that overlapped at the last step(), sorted.
+    State<std::vector<Contact>> contacts() const {
+        return _contacts;
+    }
+
+  private:
+    static constexpr uint32_t NO_INDEX = UINT32_MAX;
+    // Bounds the grid at a few cells per collider, however spread out the world is.
+    static constexpr size_t MAX_CELLS_PER_COLLIDER = 4;
+
+    float _cellSize;
+    State<std::vector<Contact>> _contacts;
+
+    // Dense columns, one entry per live collider
+    std::vector<ColliderId> _ids;
+    std::vector<float> _minX;
+    std::vector<float> _minY;
+    std::vector<float> _maxX;
+    std::vector<float> _maxY;
+    std::vector<uint32_t> _layer;
+    std::vector<uint32_t> _mask;
+    std::vector<uint32_t> _denseIndex;  // By id
+    std::vector<ColliderId> _freeIds;
+
+    // Scratch, kept across steps
+    std::vector<uint8_t> _hits;
+    std::vector<Contact> _pairs;
+    std::vector<uint32_t> _cellStart;    // Prefix sums into _cellEntries, one per cell + 1
+    std::vector<uint32_t> _cellEntries;  // Dense indices grouped by cell
+    std::vector<uint32_t> _cellRange;    // Per collider: x0, y0, x1, y1 in cells
+    float _originX = 0.0f;
+    float _originY = 0.0f;
+    float _effectiveCellSize = 1.0f;
+    uint32_t _cellsX = 1;
+    uint32_t _cellsY = 1;
+
+    void binIntoGrid() {
+        const size_t count = _ids.size();
+        float minX = _minX[0], minY = _minY[0], maxX = _maxX[0], maxY = _maxY[0];
+        for (size_t i = 1; i < count; ++i) {
+            minX = std::min(minX, _minX[i]);
+            minY = std::min(minY, _minY[i]);
+            maxX = std::max(maxX, _maxX[i]);
+            maxY = std::max(maxY, _maxY[i]);
+        }
+
+        // Grow the cells until the grid fits the budget
+        _effectiveCellSize = _cellSize;
+        const double budget = static_cast<double>(count * MAX_CELLS_PER_COLLIDER);
+        const bool finite = std::isfinite(maxX - minX) && std::isfinite(maxY - minY);
+        for (;;) {
+            if (!finite) {
+                _cellsX = 1;
+                _cellsY = 1;
+                break;
+            }
+            double cellsX = std::floor((maxX - minX) / _effectiveCellSize) + 1.0;
+            double cellsY = std::floor((maxY - minY) / _effectiveCellSize) + 1.0;
+            if (cellsX * cellsY <= budget) {
+                _cellsX = static_cast<uint32_t>(cellsX);
+                _cellsY = static_cast<uint32_t>(cellsY);
+                break;
+            }
+            _effectiveCellSize *= 2.0f;
+        }
+        _originX = minX;
+        _originY = minY;
+
+        _cellRange.resize(count * 4);
+        _cellStart.assign(static_cast<size_t>(_cellsX) * _cellsY + 1, 0);
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t* range = &_cellRange[i * 4];
+            range[0] = cellOf(_minX[i] - _originX, _cellsX);
+            range[1] = cellOf(_minY[i] - _originY, _cellsY);
+            range[2] = cellOf(_maxX[i] - _originX, _cellsX);
+            range[3] = cellOf(_maxY[i] - _originY, _cellsY);
+            for (uint32_t y = range[1]; y <= range[3]; ++y) {
+                for (uint32_t x = range[0]; x <= range[2]; ++x) {
+                    ++_cellStart[y * _cellsX + x + 1];
+                }
+            }
+        }
+        for (size_t cell = 1; cell < _cellStart.size(); ++cell) {
+            _cellStart[cell] += _cellStart[cell - 1];
+        }
+        _cellEntries.resize(_cellStart.back());
+        // Fill using the start offsets as cursors, then shift them back
+        for (size_t i = 0; i < count; ++i) {
+            const uint32_t* range = &_cellRange[i * 4];
+            for (uint32_t y = range[1]; y <= range[3]; ++y) {
+                for (uint32_t x = range[0]; x <= range[2]; ++x) {
+                    _cellEntries[_cellStart[y * _cellsX + x]++] = static_cast<uint32_t>(i);
+                }
+            }
+        }
+        for (size_t cell = _cellStart.size() - 1; cell > 0; --cell) {
+            _cellStart[cell] = _cellStart[cell - 1];
+        }
+        _cellStart[0] = 0;
+    }
+
+    uint32_t cellOf(float offset, uint32_t cells) const {
+        float cell = offset / _effectiveCellSize;
+        if (!(cell > 0.0f)) {
+            return 0;  // Also catches NaN
+        }
+        return cell < float(cells - 1) ? static_cast<uint32_t>(cell) : cells - 1;
+    }
+
+    void findPairs() {
+        for (uint32_t y = 0; y < _cellsY; ++y) {
+            for (uint32_t x = 0; x < _cellsX; ++x) {
+                const uint32_t cell = y * _cellsX + x;
+                const uint32_t begin = _cellStart[cell];
+                const uint32_t end = _cellStart[cell + 1];
+                for (uint32_t p = begin; p < end; ++p) {
+                    for (uint32_t q = p + 1; q < end; ++q) {
+                        testPair(_cellEntries[p], _cellEntries[q], x, y);
+                    }
+                }
+            }
+        }
+    }
+
+    void testPair(uint32_t i, uint32_t j, uint32_t cellX, uint32_t cellY) {
+        const uint32_t* a = &_cellRange[i * 4];
+        const uint32_t* b = &_cellRange[j * 4];
+        // Boxes spanning several cells meet in all of them; only the first shared cell counts
+        if (std::max(a[0], b[0]) != cellX || std::max(a[1], b[1]) != cellY) {
+            return;
+        }
+        if (!(_layer[i] & _mask[j]) || !(_layer[j] & _mask[i])) {
+            return;
+        }
+        if (_minX[i] < _maxX[j] && _maxX[i] > _minX[j] && _minY[i] < _maxY[j] &&
+            _maxY[i] > _minY[j]) {
+            const ColliderId first = _ids[i];
+            const ColliderId second = _ids[j];
+            _pairs.push_back({std::min(first, second), std::max(first, second)});
+        }
+    }
+};
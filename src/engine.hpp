@@ -1,460 +1,4436 @@
 #pragma once
 
+#include <SDL3/SDL_log.h>
 #include <SDL3/SDL_render.h>
 
 #include <algorithm>
-#include <any>
+#include <atomic>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <deque>
 #include <functional>
 #include <initializer_list>
 #include <iostream>
-#include <map>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <optional>
 #include <random>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 #include <type_traits>
-#include <typeindex>
+#include <unordered_map>
 #include <utility>
 #include <variant>
 #include <vector>
 
-//------------------------------------------------------------------------------
-// Engine Forward Declarations & Type Aliases
-//------------------------------------------------------------------------------
-struct Node;
-using NodePtr = std::shared_ptr<Node>;
-
-template <typename T>
-struct State;
+#include "profiler.hpp"
+#include "thread_pool.hpp"
 
-template <typename Test, template <typename...> class Ref>
-struct is_specialization : std::false_type {};
-
-template <template <typename...> class Ref, typename... Args>
-struct is_specialization<Ref<Args...>, Ref> : std::true_type {};
+// Set to 0 to send nodes, state slots and hooks straight to the system allocator.
+#ifndef FRP_USE_POOLS
+#define FRP_USE_POOLS 1
+#endif
 
-template <typename T>
-using Prop = std::variant<T, State<T>, std::function<T()>>;
+// Set to 1 to make NodePtr a non-atomic intrusive handle instead of std::shared_ptr. Cheaper
+// to copy, but node ownership must then stay on one thread.
+#ifndef FRP_INTRUSIVE_NODE_PTR
+#define FRP_INTRUSIVE_NODE_PTR 0
+#endif
 
 //------------------------------------------------------------------------------
-// State Slots (Internal Implementation for state)
+// Memory Pools
 //------------------------------------------------------------------------------
-struct BaseStateSlot {
-    virtual ~BaseStateSlot() = default;
-};
+namespace Detail {
+// Size-classed free lists for the engine's small, uniform allocations (nodes, state slots,
+// hooks). Memory is carved out of chunks that are never handed back, so once a scene has
+// reached its peak a spawn/despawn cycle is a free-list pop and push with no trip to malloc.
+// Not thread-safe: tree construction and teardown happen on the main thread.
+class SmallObjectPool {
+  public:
+    static constexpr size_t GRANULE = alignof(std::max_align_t);
+    static constexpr size_t MAX_POOLED_SIZE = 512;
+    static constexpr size_t CHUNK_SIZE = 16 * 1024;
 
-template <typename T>
-struct TypedStateSlot : BaseStateSlot {
-    T value;
-    TypedStateSlot(const T& val) : value(val) {
+    static void* allocate(size_t size) {
+        FRP_PROFILE_COUNT(Allocations);
+#if FRP_USE_POOLS
+        if (size <= MAX_POOLED_SIZE) {
+            return instance().pop(sizeClass(size));
+        }
+#endif
+        return ::operator new(size);
     }
-    TypedStateSlot(T&& val) : value(std::move(val)) {
+
+    static void deallocate(void* ptr, size_t size) {
+        if (!ptr) {
+            return;
+        }
+#if FRP_USE_POOLS
+        if (size <= MAX_POOLED_SIZE) {
+            instance().push(sizeClass(size), ptr);
+            return;
+        }
+#endif
+        ::operator delete(ptr, size);
     }
-};
 
-namespace Detail {
-struct IDependency {
-    virtual ~IDependency() = default;
-    virtual bool hasChanged() = 0;
-    virtual void updateLastValue() = 0;
-};
+  private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
 
-template <typename T>
-struct Dependency : IDependency {
-    State<T> state;
-    std::optional<T> lastValue;
+    FreeBlock* freeLists[MAX_POOLED_SIZE / GRANULE] = {};
 
-    Dependency(const State<T>& s) : state(s) {
+    // Intentionally leaked so nodes released during static destruction still have a pool.
+    static SmallObjectPool& instance() {
+        static SmallObjectPool* pool = new SmallObjectPool();
+        return *pool;
     }
 
-    bool hasChanged() override {
-        if (!state.isValid()) {
-            return false;
-        }
-        T currentValue = state.get();
-        if (!lastValue.has_value()) {
-            return true;
-        }
-        if constexpr (std::is_same_v<T, std::string> || std::is_arithmetic_v<T> ||
-                      std::is_enum_v<T>) {
-            return currentValue != *lastValue;
-        } else if constexpr (is_specialization<T, std::vector>::value) {
-            return currentValue.size() != lastValue->size();
-        } else if constexpr (requires(const T& a, const T& b) { a == b; }) {
-            return !(currentValue == *lastValue);
-        } else {
-            return true;
+    static size_t sizeClass(size_t size) {
+        return size == 0 ? 0 : (size - 1) / GRANULE;
+    }
+
+    void* pop(size_t sizeIndex) {
+        FreeBlock*& head = freeLists[sizeIndex];
+        if (!head) {
+            refill(sizeIndex);
         }
+        FreeBlock* block = head;
+        head = block->next;
+        return block;
     }
 
-    void updateLastValue() override {
-        if (state.isValid()) {
-            lastValue = state.get();
-        } else {
-            lastValue.reset();
+    void push(size_t sizeIndex, void* ptr) {
+        auto* block = static_cast<FreeBlock*>(ptr);
+        block->next = freeLists[sizeIndex];
+        freeLists[sizeIndex] = block;
+    }
+
+    void refill(size_t sizeIndex) {
+        const size_t blockSize = (sizeIndex + 1) * GRANULE;
+        const size_t blockCount = std::max<size_t>(1, CHUNK_SIZE / blockSize);
+        auto* chunk = static_cast<std::byte*>(::operator new(blockSize * blockCount));
+        for (size_t i = blockCount; i-- > 0;) {
+            push(sizeIndex, chunk + i * blockSize);
         }
     }
 };
-}  // namespace Detail
 
-struct EffectHook {
-    std::function<void()> _effectFn;
-    std::vector<std::unique_ptr<Detail::IDependency>> _dependencies;
-    bool _isFirstRun = true;
+// Standard allocator front end, used with std::allocate_shared so the control block and the
+// object share one pooled block.
+template <typename T>
+struct PoolAllocator {
+    using value_type = T;
 
-    EffectHook(std::function<void()> effectFn) : _effectFn(std::move(effectFn)) {
+    PoolAllocator() = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {
     }
-    EffectHook(EffectHook&& other) noexcept = default;
-    EffectHook& operator=(EffectHook&& other) noexcept = default;
-    EffectHook(const EffectHook&) = delete;
-    EffectHook& operator=(const EffectHook&) = delete;
 
-    template <typename T>
-    void addDependencyInternal(const State<T>& dep) {
-        _dependencies.push_back(std::make_unique<Detail::Dependency<T>>(dep));
+    T* allocate(size_t n) {
+        if constexpr (alignof(T) > SmallObjectPool::GRANULE) {
+            return std::allocator<T>{}.allocate(n);
+        } else {
+            return static_cast<T*>(SmallObjectPool::allocate(n * sizeof(T)));
+        }
     }
 
-    void runIfChanged() {
-        bool dependenciesChanged = false;
-        if (_isFirstRun) {
-            dependenciesChanged = true;
+    void deallocate(T* ptr, size_t n) {
+        if constexpr (alignof(T) > SmallObjectPool::GRANULE) {
+            std::allocator<T>{}.deallocate(ptr, n);
         } else {
-            for (const auto& dep : _dependencies) {
-                if (dep->hasChanged()) {
-                    dependenciesChanged = true;
-                    break;
-                }
-            }
-        }
-        if (dependenciesChanged) {
-            _effectFn();
-            for (auto& dep : _dependencies) {
-                dep->updateLastValue();
-            }
-            _isFirstRun = false;
+            SmallObjectPool::deallocate(ptr, n * sizeof(T));
         }
     }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const {
+        return true;
+    }
 };
 
-template <typename FirstDep, typename... RestDeps>
-void addDependenciesToEffectHook(EffectHook& eh, const FirstDep& first, const RestDeps&... rest) {
-    if constexpr (is_specialization<std::decay_t<FirstDep>, State>::value) {
-        eh.addDependencyInternal(first);
-    } else if constexpr (is_specialization<std::decay_t<FirstDep>, Prop>::value) {
-        std::visit(
-            [&eh](auto&& arg) {
-                using ArgType = std::decay_t<decltype(arg)>;
-                if constexpr (is_specialization<ArgType, State>::value) {
-                    eh.addDependencyInternal(arg);
-                }
-            },
-            first
-        );
+// Base for polymorphic engine objects owned through unique_ptr. The sized delete reaches the
+// most-derived size through the virtual destructor, so every subclass lands in its own class.
+struct PoolAllocated {
+    static void* operator new(size_t size) {
+        return SmallObjectPool::allocate(size);
     }
-    if constexpr (sizeof...(rest) > 0) {
-        addDependenciesToEffectHook(eh, rest...);
+    static void operator delete(void* ptr, size_t size) {
+        SmallObjectPool::deallocate(ptr, size);
     }
-}
-
-inline void addDependenciesToEffectHook(EffectHook&) {
-}
+};
+}  // namespace Detail
 
 //------------------------------------------------------------------------------
-// HookData (Internal data structure for a Node's hooks)
+// Intrusive Handles
 //------------------------------------------------------------------------------
-struct HookData {
-    std::vector<std::shared_ptr<BaseStateSlot>> stateSlots;
-    std::vector<std::function<void(double)>> updateEffects;
-    std::vector<std::function<void(SDL_Renderer*)>> renderEffects;
-    std::vector<std::function<void(SDL_Event*)>> eventEffects;
-    std::vector<EffectHook> effects;
+namespace Detail {
+// The count lives in the object and is a plain integer, so copying a handle is an increment
+// with no atomics and no separate control block.
+struct IntrusiveRefCounted {
+    uint32_t intrusiveRefCount = 0;
 };
 
-//------------------------------------------------------------------------------
-// State Hook
-//------------------------------------------------------------------------------
+// Provided next to each T this is used with; destroys and frees once the count hits zero.
 template <typename T>
-struct State {
-    std::shared_ptr<TypedStateSlot<T>> slot;
-    State() : slot(nullptr) {
+void destroyIntrusive(T* ptr);
+
+template <typename T>
+class IntrusivePtr {
+  public:
+    using element_type = T;
+
+    IntrusivePtr() = default;
+    IntrusivePtr(std::nullptr_t) {
     }
-    explicit State(std::shared_ptr<TypedStateSlot<T>> s) : slot(s) {
+    explicit IntrusivePtr(T* ptr) : _ptr(ptr) {
+        acquire();
     }
-
-    T get() const {
-        if (!slot) {
-            throw std::runtime_error("Accessing uninitialized state via get()");
-        }
-        return slot->value;
+    IntrusivePtr(const IntrusivePtr& other) : _ptr(other._ptr) {
+        acquire();
     }
-    void set(T newVal) {
-        if (!slot) {
-            throw std::runtime_error("Accessing uninitialized state via set()");
-        }
-        slot->value = std::move(newVal);
+    IntrusivePtr(IntrusivePtr&& other) noexcept : _ptr(std::exchange(other._ptr, nullptr)) {
     }
-    T& getRef() {
-        if (!slot) {
-            throw std::runtime_error("Accessing uninitialized state via getRef()");
-        }
-        return slot->value;
+    ~IntrusivePtr() {
+        release();
     }
-    bool isValid() const {
-        return slot != nullptr;
+
+    IntrusivePtr& operator=(const IntrusivePtr& other) {
+        IntrusivePtr(other).swap(*this);
+        return *this;
+    }
+    IntrusivePtr& operator=(IntrusivePtr&& other) noexcept {
+        IntrusivePtr(std::move(other)).swap(*this);
+        return *this;
     }
-};
 
-//------------------------------------------------------------------------------
-// Node (The core of the scene graph)
-//------------------------------------------------------------------------------
-struct Node {
-    Node* parent = nullptr;
-    std::vector<NodePtr> children;
-    HookData hookData;
-    std::map<std::type_index, std::any> providedContextsMap;
+    void swap(IntrusivePtr& other) noexcept {
+        std::swap(_ptr, other._ptr);
+    }
+    void reset() {
+        IntrusivePtr().swap(*this);
+    }
 
-    Node(Node* p = nullptr) : parent(p) {
+    T* get() const {
+        return _ptr;
+    }
+    T& operator*() const {
+        return *_ptr;
+    }
+    T* operator->() const {
+        return _ptr;
+    }
+    explicit operator bool() const {
+        return _ptr != nullptr;
     }
 
-    Node(Node* p, std::initializer_list<NodePtr> kids_init) : parent(p) {
-        children.reserve(kids_init.size());
-        for (const NodePtr& kid_ptr : kids_init) {
-            AddChild(kid_ptr);
-        }
+    friend bool operator==(const IntrusivePtr& a, const IntrusivePtr& b) {
+        return a._ptr == b._ptr;
+    }
+    friend bool operator==(const IntrusivePtr& a, std::nullptr_t) {
+        return a._ptr == nullptr;
     }
 
-    void AddChild(NodePtr child) {
-        if (child) {
-            children.push_back(child);
-            child->parent = this;
+  private:
+    T* _ptr = nullptr;
+
+    void acquire() {
+        if (_ptr) {
+            ++_ptr->intrusiveRefCount;
         }
     }
-
-    void RemoveChild(const NodePtr& childToRemove) {
-        if (!childToRemove) {
-            return;
+    void release() {
+        if (_ptr && --_ptr->intrusiveRefCount == 0) {
+            destroyIntrusive(_ptr);
         }
-        children.erase(
-            std::remove_if(
-                children.begin(),
-                children.end(),
-                [&](const NodePtr& child) {
-                    if (child == childToRemove) {
-                        child->parent = nullptr;
-                        return true;
-                    }
-                    return false;
-                }
-            ),
-            children.end()
-        );
     }
+};
+}  // namespace Detail
 
-    void SetChildren(std::initializer_list<NodePtr> newChildrenList) {
-        for (NodePtr& oldChild : children) {
-            if (oldChild) {
-                oldChild->parent = nullptr;
-            }
-        }
-        children.clear();
-        children.reserve(newChildrenList.size());
-        for (const NodePtr& child_ptr : newChildrenList) {
-            if (child_ptr) {
-                children.push_back(child_ptr);
-                child_ptr->parent = this;
-            }
-        }
+template <typename T>
+struct std::hash<Detail::IntrusivePtr<T>> {
+    size_t operator()(const Detail::IntrusivePtr<T>& ptr) const {
+        return std::hash<T*>{}(ptr.get());
     }
+};
 
-    void SetChildren(const std::vector<NodePtr>& newChildren) {
-        for (NodePtr& oldChild : children) {
-            if (oldChild) {
-                oldChild->parent = nullptr;
-            }
-        }
-        children.clear();
-        children.reserve(newChildren.size());
-        for (const NodePtr& child_ptr : newChildren) {
-            if (child_ptr) {
-                children.push_back(child_ptr);
-                child_ptr->parent = this;
-            }
-        }
+//------------------------------------------------------------------------------
+// Hook Callables
+//------------------------------------------------------------------------------
+template <typename Signature, size_t InlineSize = 64>
+class HookFn;
+
+// Move-only stand-in for std::function that hooks are stored in. Closures up to `InlineSize`
+// bytes live inside the object; bigger ones go to the small-object pool (or the system
+// allocator past its largest class). Either way a call is one indirect jump, with no copies:
+// registration forwards the closure straight into place.
+template <typename R, typename... Args, size_t InlineSize>
+class HookFn<R(Args...), InlineSize> {
+  public:
+    HookFn() = default;
+
+    HookFn(std::nullptr_t) {
     }
 
-    template <typename T>
-    std::shared_ptr<TypedStateSlot<T>> getStateSlot() {
-        for (const auto& baseSlotPtr : hookData.stateSlots) {
-            if (auto typedSlotPtr = std::dynamic_pointer_cast<TypedStateSlot<T>>(baseSlotPtr)) {
-                return typedSlotPtr;
+    template <typename F>
+        requires(!std::is_same_v<std::decay_t<F>, HookFn> &&
+                 std::is_invocable_r_v<R, std::decay_t<F>&, Args...>)
+    HookFn(F&& fn) {
+        using Target = std::decay_t<F>;
+        if constexpr (fitsInline<Target>()) {
+            ::new (static_cast<void*>(_storage)) Target(std::forward<F>(fn));
+            _ops = &inlineOps<Target>;
+        } else {
+            Target* target;
+            if constexpr (alignof(Target) <= Detail::SmallObjectPool::GRANULE) {
+                void* memory = Detail::SmallObjectPool::allocate(sizeof(Target));
+                try {
+                    target = ::new (memory) Target(std::forward<F>(fn));
+                } catch (...) {
+                    Detail::SmallObjectPool::deallocate(memory, sizeof(Target));
+                    throw;
+                }
+            } else {
+                target = new Target(std::forward<F>(fn));
             }
+            ::new (static_cast<void*>(_storage)) Target*(target);
+            _ops = &heapOps<Target>;
         }
-        return nullptr;
     }
 
-    //--------------------------------------------------------------------------
-    // Hook Methods
-    //--------------------------------------------------------------------------
-    template <typename T>
-    State<T> state(const T& initialValue) {
-        auto typedSlot = std::make_shared<TypedStateSlot<T>>(initialValue);
-        this->hookData.stateSlots.push_back(typedSlot);
-        return State<T>(typedSlot);
+    HookFn(HookFn&& other) noexcept {
+        moveFrom(other);
     }
 
-    void update(const std::function<void(double)>& fn) {
-        this->hookData.updateEffects.push_back(fn);
+    HookFn& operator=(HookFn&& other) noexcept {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
     }
 
-    void render(const std::function<void(SDL_Renderer*)>& fn) {
-        this->hookData.renderEffects.push_back(fn);
+    HookFn(const HookFn&) = delete;
+    HookFn& operator=(const HookFn&) = delete;
+
+    ~HookFn() {
+        reset();
     }
 
-    void event(const std::function<void(SDL_Event*)>& fn) {
-        this->hookData.eventEffects.push_back(fn);
+    explicit operator bool() const {
+        return _ops != nullptr;
     }
 
-    template <typename... DepTypes>
-    void effect(std::function<void()> effectFn, const DepTypes&... deps) {
-        EffectHook eh(std::move(effectFn));
-        addDependenciesToEffectHook(eh, deps...);
-        this->hookData.effects.push_back(std::move(eh));
+    // Const like std::function's: the closure itself may be mutable.
+    R operator()(Args... args) const {
+        return _ops->invoke(_storage, std::forward<Args>(args)...);
     }
 
-    template <typename F, typename... DepTypes>
-    auto derived(F&& computeFn, const DepTypes&... deps) {
-        using R = decltype(computeFn());
-        R initialValue = computeFn();
-        State<R> computedState = this->state<R>(initialValue);
-        this->effect(
-            [computedState, computeFn = std::forward<F>(computeFn)]() mutable {
-                R newValue = computeFn();
-                computedState.set(newValue);
-            },
-            deps...
-        );
-        return computedState;
+  private:
+    struct Ops {
+        R (*invoke)(void* storage, Args&&... args);
+        void (*relocate)(void* from, void* to);  // Move-constructs into `to`, destroys `from`
+        void (*destroy)(void* storage);
+    };
+
+    alignas(std::max_align_t) mutable std::byte _storage[InlineSize];
+    const Ops* _ops = nullptr;
+
+    template <typename Target>
+    static constexpr bool fitsInline() {
+        return sizeof(Target) <= InlineSize && alignof(Target) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible_v<Target>;
     }
-};
 
-inline NodePtr createNode(Node* parent = nullptr) {
-    return std::make_shared<Node>(parent);
-}
+    template <typename Target>
+    static constexpr Ops inlineOps = {
+        [](void* storage, Args&&... args) -> R {
+            return std::invoke(*static_cast<Target*>(storage), std::forward<Args>(args)...);
+        },
+        [](void* from, void* to) {
+            ::new (to) Target(std::move(*static_cast<Target*>(from)));
+            static_cast<Target*>(from)->~Target();
+        },
+        [](void* storage) { static_cast<Target*>(storage)->~Target(); },
+    };
 
-//------------------------------------------------------------------------------
-// Generic Props
-//------------------------------------------------------------------------------
-template <typename T>
-inline T val(const Prop<T>& prop) {
-    if (std::holds_alternative<T>(prop)) {
-        return std::get<T>(prop);
-    } else if (std::holds_alternative<State<T>>(prop)) {
-        const auto& state = std::get<State<T>>(prop);
-        if (state.isValid()) {
-            return state.get();
+    template <typename Target>
+    static constexpr Ops heapOps = {
+        [](void* storage, Args&&... args) -> R {
+            return std::invoke(**static_cast<Target**>(storage), std::forward<Args>(args)...);
+        },
+        [](void* from, void* to) { ::new (to) Target*(*static_cast<Target**>(from)); },
+        [](void* storage) {
+            Target* target = *static_cast<Target**>(storage);
+            if constexpr (alignof(Target) <= Detail::SmallObjectPool::GRANULE) {
+                target->~Target();
+                Detail::SmallObjectPool::deallocate(target, sizeof(Target));
+            } else {
+                delete target;
+            }
+        },
+    };
+
+    void moveFrom(HookFn& other) noexcept {
+        if (other._ops) {
+            other._ops->relocate(other._storage, _storage);
+            _ops = std::exchange(other._ops, nullptr);
         }
-    } else if (std::holds_alternative<std::function<T()>>(prop)) {
-        const auto& func = std::get<std::function<T()>>(prop);
-        if (func) {
-            return func();
+    }
+
+    void reset() {
+        if (_ops) {
+            std::exchange(_ops, nullptr)->destroy(_storage);
         }
     }
-    throw std::runtime_error("Invalid Prop<T> state or uninitialized provider");
-}
+};
 
 //------------------------------------------------------------------------------
-// Conditional Node
+// Engine Forward Declarations & Type Aliases
 //------------------------------------------------------------------------------
-inline NodePtr Conditional(State<bool> condition, NodePtr childComponent) {
-    auto node = std::make_shared<Node>();
-    node->effect(
-        [node_wptr = std::weak_ptr<Node>(node), condition, childComponent]() mutable {
-            auto node_sptr = node_wptr.lock();
-            if (!node_sptr || !childComponent) {
-                return;
-            }
-            bool isCurrentlyChild = false;
-            for (const auto& c : node_sptr->children) {
-                if (c == childComponent) {
+struct Node;
+#if FRP_INTRUSIVE_NODE_PTR
+using NodePtr = Detail::IntrusivePtr<Node>;
+#else
+using NodePtr = std::shared_ptr<Node>;
+#endif
+
+template <typename T>
+struct State;
+
+template <typename T>
+struct Computed;
+
+struct BoundsHook;
+
+namespace Detail {
+struct ContextCellBase;
+}
+
+template <typename Test, template <typename...> class Ref>
+struct is_specialization : std::false_type {};
+
+template <template <typename...> class Ref, typename... Args>
+struct is_specialization<Ref<Args...>, Ref> : std::true_type {};
+
+template <typename T>
+using Prop = std::variant<T, State<T>, std::function<T()>>;
+
+namespace Detail {
+// Set on a worker thread while it runs the update hooks of an isolated subtree (see
+// Node::isolate). Writes that would reach outside that subtree, and every change
+// notification, are queued here and committed on the main thread once the batch has joined.
+struct IsolationContext {
+    static inline thread_local const Node* root = nullptr;
+    static inline thread_local std::vector<std::function<void()>>* deferred = nullptr;
+
+    static bool active() {
+        return root != nullptr;
+    }
+
+    static void defer(std::function<void()> fn) {
+        deferred->push_back(std::move(fn));
+    }
+};
+
+// Installs an IsolationContext for the duration of a task, even if a hook throws.
+struct IsolationScope {
+    IsolationScope(const Node* root, std::vector<std::function<void()>>* deferred) {
+        IsolationContext::root = root;
+        IsolationContext::deferred = deferred;
+    }
+    ~IsolationScope() {
+        IsolationContext::root = nullptr;
+        IsolationContext::deferred = nullptr;
+    }
+    IsolationScope(const IsolationScope&) = delete;
+    IsolationScope& operator=(const IsolationScope&) = delete;
+};
+
+// Whether a slot created by `owner` belongs to the subtree the current worker is running.
+bool isInsideIsolation(const Node* owner);
+
+// Tree structure, hooks and the allocation pools are main-thread only.
+inline void requireMainThreadTreeAccess(const char* operation) {
+    if (IsolationContext::active()) {
+        throw std::runtime_error(std::string(operation) + " called from an isolated update");
+    }
+}
+
+// Anything that wants to hear about state changes (effects, for now).
+struct ISubscriber : PoolAllocated {
+    virtual ~ISubscriber() = default;
+    virtual void markDirty() = 0;
+};
+}  // namespace Detail
+
+//------------------------------------------------------------------------------
+// Change Detection Policies
+//------------------------------------------------------------------------------
+// Every write through set()/update()/getRef() bumps the slot's version. What a dependent
+// treats as a change is picked per type by specializing ChangeTraits<T> to derive from one of:
+//
+//   VersionChange  - any write is a change (the default for containers and structs)
+//   EqualityChange - set() drops writes that compare equal; uses ChangeTraits<T>::equal if
+//                    provided, operator== otherwise
+//   HashChange     - dependents rehash on notification and ignore writes that hash the same,
+//                    which also filters update()/getRef() calls that didn't modify anything;
+//                    uses ChangeTraits<T>::hash if provided, std::hash or an element-wise
+//                    hash for containers otherwise
+struct VersionChange {};
+struct EqualityChange {};
+struct HashChange {};
+
+template <typename T>
+inline constexpr bool isCheaplyComparable = std::is_arithmetic_v<T> || std::is_enum_v<T> ||
+                                            std::is_pointer_v<T> || std::is_same_v<T, std::string>;
+
+template <typename T>
+struct ChangeTraits : std::conditional_t<isCheaplyComparable<T>, EqualityChange, VersionChange> {};
+
+// Field by field, so rewriting a rect that didn't move (bounds, colliders) is not a change.
+template <>
+struct ChangeTraits<SDL_FRect> : EqualityChange {
+    static bool equal(const SDL_FRect& a, const SDL_FRect& b) {
+        return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
+    }
+};
+
+namespace Detail {
+template <typename T>
+size_t hashValue(const T& value) {
+    if constexpr (requires { ChangeTraits<T>::hash(value); }) {
+        return ChangeTraits<T>::hash(value);
+    } else if constexpr (requires { std::hash<T>{}(value); }) {
+        return std::hash<T>{}(value);
+    } else {
+        size_t seed = 0;
+        for (const auto& element : value) {
+            seed ^= hashValue(element) + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+        }
+        return seed;
+    }
+}
+}  // namespace Detail
+
+//------------------------------------------------------------------------------
+// Snapshot Encoding
+//------------------------------------------------------------------------------
+// Appends raw bytes to a snapshot buffer, see captureState().
+class SnapshotWriter {
+  public:
+    explicit SnapshotWriter(std::vector<uint8_t>& out) : _out(out) {
+    }
+
+    void write(const void* data, size_t size) {
+        const auto* bytes = static_cast<const uint8_t*>(data);
+        _out.insert(_out.end(), bytes, bytes + size);
+    }
+
+  private:
+    std::vector<uint8_t>& _out;
+};
+
+// Reads back what a SnapshotWriter wrote, throwing instead of reading past the end.
+class SnapshotReader {
+  public:
+    SnapshotReader(const uint8_t* data, size_t size) : _data(data), _size(size) {
+    }
+
+    void read(void* data, size_t size) {
+        if (size > _size - _offset) {
+            throw std::runtime_error("restoreState(): snapshot is truncated");
+        }
+        if (size > 0) {  // An empty container's data() may be null, which memcpy rejects
+            std::memcpy(data, _data + _offset, size);
+            _offset += size;
+        }
+    }
+
+    size_t offset() const {
+        return _offset;
+    }
+
+    void seek(size_t offset) {
+        _offset = offset;
+    }
+
+  private:
+    const uint8_t* _data;
+    size_t _size;
+    size_t _offset = 0;
+};
+
+// How a state type is written into a snapshot. Trivially copyable types are copied byte for
+// byte, strings and vectors as a length and their elements. Pointers and everything else
+// (loaded assets, callbacks) have `supported` false and are left out; specialize to add a type.
+template <typename T>
+struct SnapshotTraits {
+    static constexpr bool supported = std::is_trivially_copyable_v<T> && !std::is_pointer_v<T>;
+
+    static void write(SnapshotWriter& out, const T& value) {
+        out.write(&value, sizeof(T));
+    }
+
+    static void read(SnapshotReader& in, T& value) {
+        in.read(&value, sizeof(T));
+    }
+};
+
+template <>
+struct SnapshotTraits<std::string> {
+    static constexpr bool supported = true;
+
+    static void write(SnapshotWriter& out, const std::string& value) {
+        const auto length = static_cast<uint32_t>(value.size());
+        out.write(&length, sizeof(length));
+        out.write(value.data(), length);
+    }
+
+    static void read(SnapshotReader& in, std::string& value) {
+        uint32_t length = 0;
+        in.read(&length, sizeof(length));
+        value.resize(length);
+        in.read(value.data(), length);
+    }
+};
+
+// Decoding resizes the existing vector, so restoring in place keeps its capacity.
+template <typename U, typename A>
+struct SnapshotTraits<std::vector<U, A>> {
+    static constexpr bool supported = SnapshotTraits<U>::supported && !std::is_same_v<U, bool>;
+    static constexpr bool rawElements = supported && std::is_trivially_copyable_v<U>;
+
+    static void write(SnapshotWriter& out, const std::vector<U, A>& value) {
+        const auto count = static_cast<uint32_t>(value.size());
+        out.write(&count, sizeof(count));
+        if constexpr (rawElements) {
+            out.write(value.data(), count * sizeof(U));
+        } else {
+            for (const U& element : value) {
+                SnapshotTraits<U>::write(out, element);
+            }
+        }
+    }
+
+    static void read(SnapshotReader& in, std::vector<U, A>& value) {
+        uint32_t count = 0;
+        in.read(&count, sizeof(count));
+        value.resize(count);
+        if constexpr (rawElements) {
+            in.read(value.data(), count * sizeof(U));
+        } else {
+            for (U& element : value) {
+                SnapshotTraits<U>::read(in, element);
+            }
+        }
+    }
+};
+
+namespace Detail {
+// Unlike an address, never reused: a snapshot can tell a slot from a newer one that took its
+// memory.
+inline uint64_t nextSnapshotId() {
+    static std::atomic<uint64_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Data a node owns outside its state slots that captureState() includes, like Batch columns.
+struct SnapshotPart {
+    uint64_t snapshotId = nextSnapshotId();
+
+    virtual ~SnapshotPart() = default;
+    virtual void snapshotWrite(SnapshotWriter& out) const = 0;
+    virtual void snapshotRead(SnapshotReader& in) = 0;
+};
+}  // namespace Detail
+
+//------------------------------------------------------------------------------
+// State Slots (Internal Implementation for state)
+//------------------------------------------------------------------------------
+struct BaseStateSlot;
+
+namespace Detail {
+// Open batch() calls, and the slots written inside them that still have to notify. Batches
+// only open on the main thread; see batch().
+struct WriteBatch {
+    static inline int depth = 0;
+    static inline std::vector<BaseStateSlot*> pending;
+};
+}  // namespace Detail
+
+struct BaseStateSlot {
+    // Bumped on every write; subscribers are pushed a dirty mark instead of polling.
+    uint64_t version = 0;
+    // 0 for plain state; a derived() output sits one above the highest of its inputs.
+    uint32_t height = 0;
+    // Position in the owning node's hookData.stateSlots, see StateHandle.
+    uint32_t index = 0;
+    // Identifies the value type without RTTI, see Detail::typeKey.
+    const void* typeKey = nullptr;
+    // The node whose state() hook created this slot.
+    const Node* owner = nullptr;
+    // Identifies the slot in a StateSnapshot.
+    uint64_t snapshotId = Detail::nextSnapshotId();
+    // Written inside the open batch and queued in WriteBatch::pending.
+    bool batchedChange = false;
+    std::vector<Detail::ISubscriber*> subscribers;
+
+    virtual ~BaseStateSlot() {
+        if (batchedChange) {
+            auto& pending = Detail::WriteBatch::pending;
+            pending.erase(std::find(pending.begin(), pending.end(), this));
+        }
+    }
+
+    // Brings a lazily evaluated slot (see Computed) up to date; plain state always is.
+    virtual void refresh() {
+    }
+
+    // True for types on HashChange, whose dependents compare valueHash() once the version has
+    // moved, so writes that leave the value as it was are not a change.
+    virtual bool hashesChanges() const {
+        return false;
+    }
+
+    virtual size_t valueHash() const {
+        return 0;
+    }
+
+    // Whether captureState() can write this slot's value, see SnapshotTraits.
+    virtual bool snapshotSupported() const {
+        return false;
+    }
+
+    virtual void snapshotWrite(SnapshotWriter&) const {
+    }
+
+    // Decodes into the current value; the caller notifies.
+    virtual void snapshotRead(SnapshotReader&) {
+    }
+
+    void subscribe(Detail::ISubscriber* subscriber) {
+        subscribers.push_back(subscriber);
+    }
+
+    void unsubscribe(Detail::ISubscriber* subscriber) {
+        auto it = std::find(subscribers.begin(), subscribers.end(), subscriber);
+        if (it != subscribers.end()) {
+            *it = subscribers.back();
+            subscribers.pop_back();
+        }
+    }
+
+    void notifyChanged() {
+        if (Detail::IsolationContext::active()) {
+            // Subscribers are shared with the rest of the tree; mark them from the main
+            // thread. The owning node is retained by the phase lists until then.
+            Detail::IsolationContext::defer([this] { notifyChanged(); });
+            return;
+        }
+        FRP_PROFILE_COUNT(StateWrites);
+        ++version;
+        if (Detail::WriteBatch::depth > 0) {
+            if (!batchedChange) {
+                batchedChange = true;
+                Detail::WriteBatch::pending.push_back(this);
+            }
+            return;
+        }
+        notifySubscribers();
+    }
+
+    void notifySubscribers() {
+        for (auto* subscriber : subscribers) {
+            subscriber->markDirty();
+        }
+    }
+};
+
+namespace Detail {
+// Records the slots a computation reads, with the version each had, while it is installed as
+// `current`. Per thread, so reads on pool workers never land in the main thread's record.
+struct ReadTracker {
+    struct Read {
+        std::shared_ptr<BaseStateSlot> slot;
+        uint64_t version;
+        size_t hash;  // Only for slots that hash their changes
+
+        // Whether the slot moved since it was read, hashing the value where the type asks for it.
+        bool changed() const {
+            if (slot->version == version) {
+                return false;
+            }
+            return !slot->hashesChanges() || slot->valueHash() != hash;
+        }
+    };
+    std::vector<Read> reads;
+
+    static inline thread_local ReadTracker* current = nullptr;
+
+    // Compares raw pointers first, so a slot read again costs no refcount traffic.
+    template <typename Slot>
+    void record(const std::shared_ptr<Slot>& slot) {
+        for (const Read& read : reads) {
+            if (read.slot.get() == slot.get()) {
+                return;
+            }
+        }
+        const uint64_t version = slot->version;
+        const size_t hash = slot->hashesChanges() ? slot->valueHash() : 0;
+        reads.push_back({slot, version, hash});
+    }
+};
+
+// Installs a tracker for a scope, restoring the outer one (if any) on exit.
+struct TrackingScope {
+    explicit TrackingScope(ReadTracker* tracker) : _outer(ReadTracker::current) {
+        ReadTracker::current = tracker;
+    }
+    ~TrackingScope() {
+        ReadTracker::current = _outer;
+    }
+    TrackingScope(const TrackingScope&) = delete;
+    TrackingScope& operator=(const TrackingScope&) = delete;
+
+  private:
+    ReadTracker* _outer;
+};
+
+template <typename Slot>
+inline void trackRead(const std::shared_ptr<Slot>& slot) {
+    if (ReadTracker* tracker = ReadTracker::current) {
+        tracker->record(slot);
+    }
+}
+
+// One distinct address per type, usable as a compile-time type tag.
+template <typename T>
+inline constexpr char typeKeyTag = 0;
+
+template <typename T>
+constexpr const void* typeKey() {
+    return &typeKeyTag<T>;
+}
+}  // namespace Detail
+
+template <typename T>
+struct TypedStateSlot : BaseStateSlot {
+    T value;
+    TypedStateSlot(const T& val) : value(val) {
+        typeKey = Detail::typeKey<T>();
+    }
+    TypedStateSlot(T&& val) : value(std::move(val)) {
+        typeKey = Detail::typeKey<T>();
+    }
+
+    static constexpr bool usesHash = std::is_base_of_v<HashChange, ChangeTraits<T>>;
+
+    bool hashesChanges() const override {
+        return usesHash;
+    }
+
+    size_t valueHash() const override {
+        if constexpr (usesHash) {
+            return Detail::hashValue(value);
+        } else {
+            return 0;
+        }
+    }
+
+    bool snapshotSupported() const override {
+        return SnapshotTraits<T>::supported;
+    }
+
+    void snapshotWrite(SnapshotWriter& out) const override {
+        if constexpr (SnapshotTraits<T>::supported) {
+            SnapshotTraits<T>::write(out, value);
+        }
+    }
+
+    void snapshotRead(SnapshotReader& in) override {
+        if constexpr (SnapshotTraits<T>::supported) {
+            SnapshotTraits<T>::read(in, value);
+        }
+    }
+};
+
+// Typed index of a state slot inside a node. Hooks run in the same order for every instance
+// of a component, so a handle taken from one instance addresses the same slot on all of them.
+template <typename T>
+struct StateHandle {
+    uint32_t index = UINT32_MAX;
+
+    bool isValid() const {
+        return index != UINT32_MAX;
+    }
+};
+
+namespace Detail {
+struct IDependency : PoolAllocated {
+    virtual ~IDependency() = default;
+    virtual bool hasChanged() = 0;
+    virtual void updateLastValue() = 0;
+    virtual const BaseStateSlot* sourceSlot() const = 0;
+};
+
+// Change detection compares slot versions, so checking a dependency normally never touches
+// the value. Types on HashChange additionally compare a hash once the version has moved.
+template <typename T>
+struct Dependency : IDependency {
+    static constexpr bool usesHash = std::is_base_of_v<HashChange, ChangeTraits<T>>;
+
+    State<T> state;
+    uint64_t lastVersion = 0;
+    size_t lastHash = 0;
+    ISubscriber* subscriber;
+
+    Dependency(const State<T>& s, ISubscriber* sub) : state(s), subscriber(sub) {
+        if (state.isValid()) {
+            state.slot->subscribe(subscriber);
+            lastVersion = state.slot->version;
+            if constexpr (usesHash) {
+                lastHash = hashValue(state.slot->value);
+            }
+        }
+    }
+    ~Dependency() override {
+        if (state.isValid()) {
+            state.slot->unsubscribe(subscriber);
+        }
+    }
+    Dependency(const Dependency&) = delete;
+    Dependency& operator=(const Dependency&) = delete;
+
+    bool hasChanged() override {
+        if (!state.isValid() || state.slot->version == lastVersion) {
+            return false;
+        }
+        if constexpr (usesHash) {
+            return hashValue(state.slot->value) != lastHash;
+        } else {
+            return true;
+        }
+    }
+
+    void updateLastValue() override {
+        if (!state.isValid()) {
+            return;
+        }
+        if constexpr (usesHash) {
+            if (state.slot->version != lastVersion) {
+                lastHash = hashValue(state.slot->value);
+            }
+        }
+        lastVersion = state.slot->version;
+    }
+
+    const BaseStateSlot* sourceSlot() const override {
+        return state.slot.get();
+    }
+};
+
+// A dependency on a slot of any type, as tracked hooks record them. Checking it pulls a lazily
+// evaluated slot (see Computed) up to date first, so an unchanged recomputation doesn't count
+// as a change, and applies the slot's HashChange filter like Dependency does.
+struct SlotDependency : IDependency {
+    std::shared_ptr<BaseStateSlot> slot;
+    uint64_t lastVersion;
+    size_t lastHash;
+    ISubscriber* subscriber;
+
+    SlotDependency(std::shared_ptr<BaseStateSlot> s, ISubscriber* sub)
+        : slot(std::move(s))
+        , lastVersion(slot->version)
+        , lastHash(slot->hashesChanges() ? slot->valueHash() : 0)
+        , subscriber(sub) {
+        slot->subscribe(subscriber);
+    }
+    ~SlotDependency() override {
+        slot->unsubscribe(subscriber);
+    }
+    SlotDependency(const SlotDependency&) = delete;
+    SlotDependency& operator=(const SlotDependency&) = delete;
+
+    bool hasChanged() override {
+        slot->refresh();
+        if (slot->version == lastVersion) {
+            return false;
+        }
+        return !slot->hashesChanges() || slot->valueHash() != lastHash;
+    }
+
+    void updateLastValue() override {
+        slot->refresh();
+        if (slot->version != lastVersion && slot->hashesChanges()) {
+            lastHash = slot->valueHash();
+        }
+        lastVersion = slot->version;
+    }
+
+    const BaseStateSlot* sourceSlot() const override {
+        return slot.get();
+    }
+};
+
+using DependencyList = std::vector<std::unique_ptr<IDependency>>;
+
+inline bool anyDependencyChanged(const DependencyList& dependencies) {
+    for (const auto& dep : dependencies) {
+        if (dep->hasChanged()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void updateLastValues(DependencyList& dependencies) {
+    for (auto& dep : dependencies) {
+        dep->updateLastValue();
+    }
+}
+
+// Makes a tracked hook depend on exactly what its last run read. When that is what it read
+// the time before, which is the usual case, only the recorded versions move; otherwise the
+// list is rebuilt, which drops inputs the run no longer reached.
+inline void retrack(
+    DependencyList& dependencies,
+    std::vector<ReadTracker::Read>& reads,
+    ISubscriber* subscriber
+) {
+    bool unchanged = dependencies.size() == reads.size();
+    for (size_t i = 0; unchanged && i < reads.size(); ++i) {
+        unchanged = dependencies[i]->sourceSlot() == reads[i].slot.get();
+    }
+    if (unchanged) {
+        updateLastValues(dependencies);
+    } else {
+        dependencies.clear();
+        for (auto& read : reads) {
+            dependencies.push_back(
+                std::make_unique<SlotDependency>(std::move(read.slot), subscriber)
+            );
+        }
+    }
+}
+}  // namespace Detail
+
+// Effects subscribe to the slots they depend on. A write marks the effect dirty and bumps
+// its owner's dirty count, so updateTree only looks at effects whose inputs were written.
+// Effects are heap-pinned (see HookData::effects) because slots hold raw pointers to them.
+struct EffectHook : Detail::ISubscriber {
+    Node* _owner;
+    HookFn<void()> _effectFn;
+    Detail::DependencyList _dependencies;
+    Detail::ReadTracker _tracker;  // Only used when tracked
+    bool _isFirstRun = true;
+    bool _dirty = false;
+    bool _tracked = false;  // Dependencies are whatever the last run read
+    bool _forced = false;   // Runs next pass even if no dependency changed
+
+    EffectHook(Node* owner, HookFn<void()> effectFn)
+        : _owner(owner)
+        , _effectFn(std::move(effectFn)) {
+    }
+    EffectHook(EffectHook&&) = delete;
+    EffectHook& operator=(EffectHook&&) = delete;
+    EffectHook(const EffectHook&) = delete;
+    EffectHook& operator=(const EffectHook&) = delete;
+
+    template <typename T>
+    void addDependencyInternal(const State<T>& dep) {
+        _dependencies.push_back(std::make_unique<Detail::Dependency<T>>(dep, this));
+    }
+
+    void markDirty() override;
+    void runIfChanged();
+    // Reruns it although its inputs didn't change, e.g. when a context it read was rebound.
+    void force() {
+        _forced = true;
+        markDirty();
+    }
+};
+
+// A derived() computation. Unlike effects these are not run from the tree walk: a dirty
+// mark queues them on the DerivedScheduler, which runs them lowest height first so that a
+// chain of derived values settles in a single pass and each one runs once per invalidation.
+struct DerivedHook : Detail::ISubscriber {
+    HookFn<void()> _computeFn;  // Recomputes and writes the output state
+    Detail::DependencyList _dependencies;
+    Detail::ReadTracker _tracker;  // Only used when tracked
+    BaseStateSlot* _output = nullptr;
+    uint32_t _height = 1;
+    uint64_t _order = 0;  // Creation order, breaks height ties deterministically
+    bool _queued = false;
+    bool _tracked = false;  // Dependencies are whatever the last run read
+    bool _forced = false;   // Runs next flush even if no dependency changed
+
+    explicit DerivedHook(HookFn<void()> computeFn) : _computeFn(std::move(computeFn)) {
+    }
+    ~DerivedHook() override;
+    DerivedHook(const DerivedHook&) = delete;
+    DerivedHook& operator=(const DerivedHook&) = delete;
+
+    template <typename T>
+    void addDependencyInternal(const State<T>& dep) {
+        _dependencies.push_back(std::make_unique<Detail::Dependency<T>>(dep, this));
+    }
+
+    // Called once all dependencies are attached and the initial value has been computed.
+    void bindOutput(BaseStateSlot* output);
+    void markDirty() override;
+    void runIfChanged();
+    void force() {
+        _forced = true;
+        markDirty();
+    }
+
+  private:
+    void updateHeight();
+};
+
+namespace Detail {
+struct DerivedScheduler {
+    static inline std::vector<DerivedHook*> queue;  // Min-heap on (height, order)
+    static inline uint64_t nextOrder = 0;
+
+    static bool runsAfter(const DerivedHook* a, const DerivedHook* b) {
+        return a->_height != b->_height ? a->_height > b->_height : a->_order > b->_order;
+    }
+
+    static void enqueue(DerivedHook* hook) {
+        queue.push_back(hook);
+        std::push_heap(queue.begin(), queue.end(), runsAfter);
+    }
+
+    static void remove(DerivedHook* hook) {
+        auto it = std::find(queue.begin(), queue.end(), hook);
+        if (it != queue.end()) {
+            queue.erase(it);
+            std::make_heap(queue.begin(), queue.end(), runsAfter);
+        }
+    }
+
+    // Dependents always sit strictly higher than their inputs, so by the time a hook is
+    // popped every input it reads has already been brought up to date.
+    static void flush() {
+        while (!queue.empty()) {
+            std::pop_heap(queue.begin(), queue.end(), runsAfter);
+            DerivedHook* hook = queue.back();
+            queue.pop_back();
+            hook->_queued = false;
+            hook->runIfChanged();
+        }
+    }
+};
+}  // namespace Detail
+
+inline DerivedHook::~DerivedHook() {
+    if (_queued) {
+        Detail::DerivedScheduler::remove(this);
+    }
+}
+
+inline void DerivedHook::bindOutput(BaseStateSlot* output) {
+    _output = output;
+    _order = Detail::DerivedScheduler::nextOrder++;
+    updateHeight();
+    Detail::updateLastValues(_dependencies);
+}
+
+inline void DerivedHook::updateHeight() {
+    uint32_t inputHeight = 0;
+    for (const auto& dep : _dependencies) {
+        if (const BaseStateSlot* source = dep->sourceSlot()) {
+            inputHeight = std::max(inputHeight, source->height);
+        }
+    }
+    _height = inputHeight + 1;
+    _output->height = _height;
+}
+
+inline void DerivedHook::markDirty() {
+    if (!_queued) {
+        _queued = true;
+        Detail::DerivedScheduler::enqueue(this);
+    }
+}
+
+inline void DerivedHook::runIfChanged() {
+    if (!std::exchange(_forced, false) && !Detail::anyDependencyChanged(_dependencies)) {
+        return;
+    }
+    FRP_PROFILE_COUNT(DerivedRuns);
+    {
+        // Untracked runs install no tracker, so their reads don't leak into an outer one
+        _tracker.reads.clear();
+        Detail::TrackingScope scope(_tracked ? &_tracker : nullptr);
+        _computeFn();
+    }
+    if (_tracked) {
+        Detail::retrack(_dependencies, _tracker.reads, this);
+        updateHeight();  // A new input may sit higher than the old ones
+    } else {
+        Detail::updateLastValues(_dependencies);
+    }
+}
+
+template <typename Hook, typename FirstDep, typename... RestDeps>
+void addDependenciesToHook(Hook& hook, const FirstDep& first, const RestDeps&... rest) {
+    if constexpr (is_specialization<std::decay_t<FirstDep>, State>::value) {
+        hook.addDependencyInternal(first);
+    } else if constexpr (is_specialization<std::decay_t<FirstDep>, Computed>::value) {
+        if (first.isValid()) {
+            hook._dependencies.push_back(
+                std::make_unique<Detail::SlotDependency>(first.slot, &hook)
+            );
+        }
+    } else if constexpr (is_specialization<std::decay_t<FirstDep>, Prop>::value) {
+        std::visit(
+            [&hook](auto&& arg) {
+                using ArgType = std::decay_t<decltype(arg)>;
+                if constexpr (is_specialization<ArgType, State>::value) {
+                    hook.addDependencyInternal(arg);
+                }
+            },
+            first
+        );
+    }
+    if constexpr (sizeof...(rest) > 0) {
+        addDependenciesToHook(hook, rest...);
+    }
+}
+
+template <typename Hook>
+void addDependenciesToHook(Hook&) {
+}
+
+//------------------------------------------------------------------------------
+// Render Commands
+//------------------------------------------------------------------------------
+// Frame-level draw buffer. During renderTree, the draw* functions below record into the root's
+// list instead of calling SDL; the list is then sorted by (layer, texture, color) and flushed
+// as one SDL_RenderFillRects per color run and one SDL_RenderGeometry per texture run. Layers
+// are the only ordering guarantee: within a layer, draws are grouped by state, not by the
+// order the hooks ran in.
+class RenderList {
+  public:
+    void clear() {
+        _commands.clear();
+        _rects.clear();
+        _vertices.clear();
+        _indices.clear();
+    }
+
+    bool empty() const {
+        return _commands.empty();
+    }
+
+    void fillRect(SDL_Color color, const SDL_FRect& rect, int layer) {
+        push(Kind::FillRect, layer, nullptr, color, _rects.size(), 1, 0, 0);
+        _rects.push_back(rect);
+    }
+
+    // `source` is in texels, or nullptr for the whole texture.
+    void texture(SDL_Texture* texture, const SDL_FRect* source, const SDL_FRect& dest, int layer) {
+        float u0 = 0.0f, v0 = 0.0f, u1 = 1.0f, v1 = 1.0f;
+        if (source) {
+            float width = 1.0f, height = 1.0f;
+            SDL_GetTextureSize(texture, &width, &height);
+            u0 = source->x / width;
+            v0 = source->y / height;
+            u1 = (source->x + source->w) / width;
+            v1 = (source->y + source->h) / height;
+        }
+        const SDL_FColor white = {1.0f, 1.0f, 1.0f, 1.0f};
+        const SDL_Vertex quad[4] = {
+            {{dest.x, dest.y}, white, {u0, v0}},
+            {{dest.x + dest.w, dest.y}, white, {u1, v0}},
+            {{dest.x + dest.w, dest.y + dest.h}, white, {u1, v1}},
+            {{dest.x, dest.y + dest.h}, white, {u0, v1}},
+        };
+        const int indices[6] = {0, 1, 2, 0, 2, 3};
+        geometry(texture, quad, 4, indices, 6, layer);
+    }
+
+    void geometry(
+        SDL_Texture* texture,
+        const SDL_Vertex* vertices,
+        int vertexCount,
+        const int* indices,
+        int indexCount,
+        int layer
+    ) {
+        if (vertexCount <= 0) {
+            return;
+        }
+        const size_t firstIndex = _indices.size();
+        if (indices) {
+            _indices.insert(_indices.end(), indices, indices + indexCount);
+        } else {
+            indexCount = vertexCount;
+            for (int i = 0; i < vertexCount; ++i) {
+                _indices.push_back(i);
+            }
+        }
+        push(
+            Kind::Geometry,
+            layer,
+            texture,
+            {},
+            _vertices.size(),
+            static_cast<uint32_t>(vertexCount),
+            firstIndex,
+            static_cast<uint32_t>(indexCount)
+        );
+        _vertices.insert(_vertices.end(), vertices, vertices + vertexCount);
+    }
+
+    // Replays commands recorded into another list, as if they had been issued again.
+    void append(const RenderList& other) {
+        const auto rectBase = static_cast<uint32_t>(_rects.size());
+        const auto vertexBase = static_cast<uint32_t>(_vertices.size());
+        const auto indexBase = static_cast<uint32_t>(_indices.size());
+        for (Command command : other._commands) {
+            command.first += command.kind == Kind::FillRect ? rectBase : vertexBase;
+            command.firstIndex += indexBase;
+            _commands.push_back(command);
+        }
+        _rects.insert(_rects.end(), other._rects.begin(), other._rects.end());
+        _vertices.insert(_vertices.end(), other._vertices.begin(), other._vertices.end());
+        _indices.insert(_indices.end(), other._indices.begin(), other._indices.end());
+    }
+
+    void flush(SDL_Renderer* renderer) {
+        // Stable, so draws that share all three keys keep their submission order
+        std::stable_sort(_commands.begin(), _commands.end(), [](const auto& a, const auto& b) {
+            if (a.layer != b.layer) {
+                return a.layer < b.layer;
+            }
+            if (a.kind != b.kind) {
+                return a.kind < b.kind;
+            }
+            if (a.texture != b.texture) {
+                return std::less<SDL_Texture*>()(a.texture, b.texture);
+            }
+            return a.color < b.color;
+        });
+
+        for (size_t begin = 0; begin < _commands.size();) {
+            const Command& first = _commands[begin];
+            size_t end = begin + 1;
+            while (end < _commands.size() && sameBatch(first, _commands[end])) {
+                ++end;
+            }
+            if (first.kind == Kind::FillRect) {
+                flushRects(renderer, begin, end);
+            } else {
+                flushGeometry(renderer, begin, end);
+            }
+            begin = end;
+        }
+        clear();
+    }
+
+  private:
+    enum class Kind : uint8_t { FillRect, Geometry };
+
+    struct Command {
+        int layer;
+        Kind kind;
+        SDL_Texture* texture;
+        uint32_t color;  // Packed RGBA, fill rects only
+        uint32_t first;  // Into _rects or _vertices
+        uint32_t count;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+    };
+
+    std::vector<Command> _commands;
+    std::vector<SDL_FRect> _rects;
+    std::vector<SDL_Vertex> _vertices;
+    std::vector<int> _indices;
+
+    // Flush scratch, kept across frames
+    std::vector<SDL_FRect> _batchRects;
+    std::vector<SDL_Vertex> _batchVertices;
+    std::vector<int> _batchIndices;
+
+    static uint32_t pack(SDL_Color color) {
+        return (uint32_t(color.r) << 24) | (uint32_t(color.g) << 16) | (uint32_t(color.b) << 8) |
+               uint32_t(color.a);
+    }
+
+    static bool sameBatch(const Command& a, const Command& b) {
+        return a.layer == b.layer && a.kind == b.kind && a.texture == b.texture &&
+               a.color == b.color;
+    }
+
+    void push(
+        Kind kind,
+        int layer,
+        SDL_Texture* texture,
+        SDL_Color color,
+        size_t first,
+        uint32_t count,
+        size_t firstIndex,
+        uint32_t indexCount
+    ) {
+        _commands.push_back({
+            layer,
+            kind,
+            texture,
+            kind == Kind::FillRect ? pack(color) : 0,
+            static_cast<uint32_t>(first),
+            count,
+            static_cast<uint32_t>(firstIndex),
+            indexCount,
+        });
+    }
+
+    void flushRects(SDL_Renderer* renderer, size_t begin, size_t end) {
+        const uint32_t color = _commands[begin].color;
+        SDL_SetRenderDrawColor(
+            renderer,
+            static_cast<Uint8>(color >> 24),
+            static_cast<Uint8>(color >> 16),
+            static_cast<Uint8>(color >> 8),
+            static_cast<Uint8>(color)
+        );
+        _batchRects.clear();
+        for (size_t i = begin; i < end; ++i) {
+            const Command& command = _commands[i];
+            _batchRects.insert(
+                _batchRects.end(),
+                _rects.begin() + command.first,
+                _rects.begin() + command.first + command.count
+            );
+        }
+        SDL_RenderFillRects(renderer, _batchRects.data(), static_cast<int>(_batchRects.size()));
+    }
+
+    void flushGeometry(SDL_Renderer* renderer, size_t begin, size_t end) {
+        _batchVertices.clear();
+        _batchIndices.clear();
+        for (size_t i = begin; i < end; ++i) {
+            const Command& command = _commands[i];
+            const int base = static_cast<int>(_batchVertices.size());
+            _batchVertices.insert(
+                _batchVertices.end(),
+                _vertices.begin() + command.first,
+                _vertices.begin() + command.first + command.count
+            );
+            for (uint32_t j = 0; j < command.indexCount; ++j) {
+                _batchIndices.push_back(base + _indices[command.firstIndex + j]);
+            }
+        }
+        SDL_RenderGeometry(
+            renderer,
+            _commands[begin].texture,
+            _batchVertices.data(),
+            static_cast<int>(_batchVertices.size()),
+            _batchIndices.data(),
+            static_cast<int>(_batchIndices.size())
+        );
+    }
+};
+
+namespace Detail {
+// The list renderTree is currently recording into, if any, and the interpolation alpha it
+// was called with.
+struct RenderRecording {
+    static inline RenderList* list = nullptr;
+    static inline double alpha = 1.0;
+};
+
+// Restores the previous list on exit, so a cached hook can record into its own list in the
+// middle of a frame.
+struct RenderRecordingScope {
+    RenderList* previous;
+
+    explicit RenderRecordingScope(RenderList* list) : previous(RenderRecording::list) {
+        RenderRecording::list = list;
+    }
+    ~RenderRecordingScope() {
+        RenderRecording::list = previous;
+        if (!previous) {
+            RenderRecording::alpha = 1.0;
+        }
+    }
+    RenderRecordingScope(const RenderRecordingScope&) = delete;
+    RenderRecordingScope& operator=(const RenderRecordingScope&) = delete;
+};
+}  // namespace Detail
+
+// How far between the last two simulation steps this frame is being drawn, in [0, 1]. 1 (the
+// default) means "at the latest state". Hooks that interpolate with it see a new value every
+// frame, so register them without dependencies rather than as cached renders.
+inline double renderAlpha() {
+    return Detail::RenderRecording::alpha;
+}
+
+// Drawing entry points for render hooks. Inside renderTree they are batched; called anywhere
+// else they draw immediately, so components still work with a hand-rolled render loop.
+inline void drawFillRect(
+    SDL_Renderer* renderer,
+    SDL_Color color,
+    const SDL_FRect& rect,
+    int layer = 0
+) {
+    if (auto* list = Detail::RenderRecording::list) {
+        list->fillRect(color, rect, layer);
+        return;
+    }
+    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+    SDL_RenderFillRect(renderer, &rect);
+}
+
+inline void drawTexture(
+    SDL_Renderer* renderer,
+    SDL_Texture* texture,
+    const SDL_FRect* source,
+    const SDL_FRect& dest,
+    int layer = 0
+) {
+    if (auto* list = Detail::RenderRecording::list) {
+        list->texture(texture, source, dest, layer);
+        return;
+    }
+    SDL_RenderTexture(renderer, texture, source, &dest);
+}
+
+// Indices may be nullptr for a plain triangle list.
+inline void drawGeometry(
+    SDL_Renderer* renderer,
+    SDL_Texture* texture,
+    const SDL_Vertex* vertices,
+    int vertexCount,
+    const int* indices,
+    int indexCount,
+    int layer = 0
+) {
+    if (auto* list = Detail::RenderRecording::list) {
+        list->geometry(texture, vertices, vertexCount, indices, indexCount, layer);
+        return;
+    }
+    SDL_RenderGeometry(renderer, texture, vertices, vertexCount, indices, indexCount);
+}
+
+// A render() registered with dependencies. Its commands are recorded once and replayed into
+// the frame list until one of the dependencies changes, so a static panel costs a copy of its
+// commands per frame rather than a run of its closure. The closure must read nothing that
+// isn't listed, or the replay goes stale.
+struct CachedRenderHook : Detail::ISubscriber {
+    HookFn<void(SDL_Renderer*)> _renderFn;
+    Detail::DependencyList _dependencies;
+    RenderList _recorded;
+    SDL_Renderer* _recordedFor = nullptr;
+    bool _hasRecording = false;
+    bool _dirty = true;
+
+    explicit CachedRenderHook(HookFn<void(SDL_Renderer*)> renderFn)
+        : _renderFn(std::move(renderFn)) {
+    }
+    CachedRenderHook(const CachedRenderHook&) = delete;
+    CachedRenderHook& operator=(const CachedRenderHook&) = delete;
+
+    template <typename T>
+    void addDependencyInternal(const State<T>& dep) {
+        _dependencies.push_back(std::make_unique<Detail::Dependency<T>>(dep, this));
+    }
+
+    void markDirty() override {
+        _dirty = true;
+    }
+
+    void render(SDL_Renderer* renderer) {
+        RenderList* frame = Detail::RenderRecording::list;
+        if (!frame) {
+            _renderFn(renderer);  // Immediate mode, nothing to cache into
+            return;
+        }
+        const bool stale = !_hasRecording || _recordedFor != renderer ||
+                           (_dirty && Detail::anyDependencyChanged(_dependencies));
+        if (stale) {
+            _recorded.clear();
+            Detail::RenderRecordingScope recording(&_recorded);
+            _renderFn(renderer);
+            _recordedFor = renderer;
+            _hasRecording = true;
+        }
+        if (_dirty) {
+            Detail::updateLastValues(_dependencies);
+            _dirty = false;
+        }
+        frame->append(_recorded);
+    }
+};
+
+// An on()/onKey() subscription. `scancode` narrows key events; -1 accepts any key.
+struct EventListener {
+    Uint32 type;
+    int scancode;
+    HookFn<void(SDL_Event*)> fn;
+};
+
+//------------------------------------------------------------------------------
+// HookData (Internal data structure for a Node's hooks)
+//------------------------------------------------------------------------------
+// Callback hooks live in deques so registering another one never moves the existing ones;
+// the flattened phase lists point straight at them.
+struct HookData {
+    std::vector<std::shared_ptr<BaseStateSlot>> stateSlots;
+    std::deque<HookFn<void(double)>> updateEffects;
+    std::deque<HookFn<void(SDL_Renderer*)>> renderEffects;
+    std::deque<HookFn<void(SDL_Event*)>> eventEffects;
+    std::deque<EventListener> eventListeners;
+    std::vector<std::unique_ptr<EffectHook>> effects;
+    std::vector<std::unique_ptr<DerivedHook>> derived;
+    std::vector<std::unique_ptr<CachedRenderHook>> cachedRenders;
+    std::vector<std::shared_ptr<void>> batches;  // Keeps Node::batch() stores alive
+    std::vector<Detail::SnapshotPart*> snapshotParts;  // Batches captureState() includes
+    std::vector<std::shared_ptr<BaseStateSlot>> computeds;
+    std::vector<std::shared_ptr<Detail::ContextCellBase>> contexts;  // See Node::use()
+    std::unique_ptr<BoundsHook> bounds;                               // See Node::bounds()
+    std::vector<std::shared_ptr<void>> resources;  // Keeps Node::resource() loads alive
+};
+
+//------------------------------------------------------------------------------
+// State Hook
+//------------------------------------------------------------------------------
+namespace Detail {
+template <typename T>
+bool valuesEqual(const T& a, const T& b) {
+    if constexpr (requires { ChangeTraits<T>::equal(a, b); }) {
+        return ChangeTraits<T>::equal(a, b);
+    } else {
+        return a == b;
+    }
+}
+
+// Writes that leave the value unchanged are dropped under EqualityChange. The other
+// policies can't tell from here, so every write counts.
+template <typename T>
+bool valuesDiffer(const T& oldValue, const T& newValue) {
+    if constexpr (std::is_base_of_v<EqualityChange, ChangeTraits<T>>) {
+        return !valuesEqual(oldValue, newValue);
+    } else {
+        return true;
+    }
+}
+
+// For writes the engine makes on a caller's behalf, which often repeat the current value: any
+// type that can be compared is, whatever its policy, and only one that can't counts every write.
+template <typename T>
+bool writeBackDiffers(const T& oldValue, const T& newValue) {
+    if constexpr (requires { ChangeTraits<T>::equal(oldValue, newValue); } ||
+                  requires { oldValue == newValue; }) {
+        return !valuesEqual(oldValue, newValue);
+    } else {
+        return true;
+    }
+}
+}  // namespace Detail
+
+namespace Detail {
+// A slot not listed in any node's stateSlots (no handle), for engine-owned state such as the
+// per-item state of a keyed list.
+template <typename T>
+std::shared_ptr<TypedStateSlot<T>> makeStateSlot(const T& initialValue, Node* owner) {
+    auto typedSlot =
+        std::allocate_shared<TypedStateSlot<T>>(PoolAllocator<TypedStateSlot<T>>{}, initialValue);
+    typedSlot->owner = owner;
+    return typedSlot;
+}
+}  // namespace Detail
+
+template <typename T>
+struct State {
+    std::shared_ptr<TypedStateSlot<T>> slot;
+    State() : slot(nullptr) {
+    }
+    explicit State(std::shared_ptr<TypedStateSlot<T>> s) : slot(s) {
+    }
+
+    const T& get() const {
+        if (!slot) {
+            throw std::runtime_error("Accessing uninitialized state via get()");
+        }
+        Detail::trackRead(slot);
+        return slot->value;
+    }
+    // get() without becoming a dependency of a tracked effect, derived or computed.
+    const T& peek() const {
+        if (!slot) {
+            throw std::runtime_error("Accessing uninitialized state via peek()");
+        }
+        return slot->value;
+    }
+    void set(T newVal) {
+        if (!slot) {
+            throw std::runtime_error("Accessing uninitialized state via set()");
+        }
+        if (isForeignToIsolation()) {
+            Detail::IsolationContext::defer([state = *this, value = std::move(newVal)]() mutable {
+                state.set(std::move(value));
+            });
+            return;
+        }
+        if (!Detail::valuesDiffer(slot->value, newVal)) {
+            return;
+        }
+        slot->value = std::move(newVal);
+        slot->notifyChanged();
+    }
+    // Mutates the value in place and marks dependents dirty, without copying it out first.
+    template <typename F>
+    void update(F&& fn) {
+        if (!slot) {
+            throw std::runtime_error("Accessing uninitialized state via update()");
+        }
+        if (isForeignToIsolation()) {
+            Detail::IsolationContext::defer([state = *this, fn = std::forward<F>(fn)]() mutable {
+                state.update(fn);
+            });
+            return;
+        }
+        std::forward<F>(fn)(slot->value);
+        slot->notifyChanged();
+    }
+    // The caller may mutate through the reference, so dependents are marked dirty up front.
+    T& getRef() {
+        if (!slot) {
+            throw std::runtime_error("Accessing uninitialized state via getRef()");
+        }
+        if (isForeignToIsolation()) {
+            throw std::runtime_error("getRef() on state outside an isolated subtree; use update()");
+        }
+        slot->notifyChanged();
+        return slot->value;
+    }
+    bool isValid() const {
+        return slot != nullptr;
+    }
+    StateHandle<T> handle() const {
+        return slot ? StateHandle<T>{slot->index} : StateHandle<T>{};
+    }
+
+  private:
+    bool isForeignToIsolation() const {
+        return Detail::IsolationContext::active() && !Detail::isInsideIsolation(slot->owner);
+    }
+};
+
+//------------------------------------------------------------------------------
+// Batched Writes
+//------------------------------------------------------------------------------
+namespace Detail {
+// Closes one batch level; the outermost one sends the held-back notifications, also when the
+// batch body throws.
+struct WriteBatchScope {
+    WriteBatchScope() {
+        ++WriteBatch::depth;
+    }
+    ~WriteBatchScope() {
+        if (--WriteBatch::depth > 0) {
+            return;
+        }
+        // Marking dirty never writes state, so nothing joins the list while it is drained
+        for (BaseStateSlot* slot : WriteBatch::pending) {
+            slot->batchedChange = false;
+            slot->notifySubscribers();
+        }
+        WriteBatch::pending.clear();
+    }
+    WriteBatchScope(const WriteBatchScope&) = delete;
+    WriteBatchScope& operator=(const WriteBatchScope&) = delete;
+};
+}  // namespace Detail
+
+// Runs `fn` as one transaction: states it writes take their new values at once, but their
+// dependents are only marked when the outermost batch returns, once per state however often it
+// was written, and derived values are brought up to date before batch() returns. Nothing
+// downstream observes a half-applied group of writes, while computed() values read inside `fn`
+// already reflect them. On an isolated worker writes are already held until the commit step,
+// so there `fn` simply runs.
+template <typename F>
+void batch(F&& fn) {
+    if (Detail::IsolationContext::active()) {
+        std::forward<F>(fn)();
+        return;
+    }
+    {
+        Detail::WriteBatchScope scope;
+        std::forward<F>(fn)();
+    }
+    if (Detail::WriteBatch::depth == 0) {
+        Detail::DerivedScheduler::flush();
+    }
+}
+
+//------------------------------------------------------------------------------
+// Computed Values
+//------------------------------------------------------------------------------
+namespace Detail {
+// Pull-based counterpart of a derived() output. A write to a source only marks it stale and
+// passes the mark on to its own subscribers; the function runs when the value is next read,
+// and only if a source it read last time has actually moved. Sources are whatever the last
+// run read, recorded through a ReadTracker, so they follow branches in the function.
+template <typename T>
+struct ComputedSlot final : BaseStateSlot, ISubscriber {
+    HookFn<T()> computeFn;
+    std::optional<T> value;
+    std::vector<ReadTracker::Read> sources;
+    bool stale = true;
+    bool evaluating = false;
+
+    template <typename F>
+    explicit ComputedSlot(F&& fn) : computeFn(std::forward<F>(fn)) {
+        typeKey = Detail::typeKey<T>();
+    }
+    ~ComputedSlot() override {
+        for (auto& source : sources) {
+            source.slot->unsubscribe(this);
+        }
+    }
+    ComputedSlot(const ComputedSlot&) = delete;
+    ComputedSlot& operator=(const ComputedSlot&) = delete;
+
+    void markDirty() override {
+        if (!stale) {
+            stale = true;
+            notifySubscribers();
+        }
+    }
+
+    void refresh() override {
+        if (!stale) {
+            // Inside batch() writes only notify once it closes, so look at the sources instead
+            if (WriteBatch::depth == 0 || !sourcesChanged()) {
+                return;
+            }
+        } else {
+            if (IsolationContext::active()) {
+                throw std::runtime_error(
+                    "computed(): stale value read in an isolated update; read it outside first"
+                );
+            }
+            if (value && !sourcesChanged()) {
+                stale = false;
+                return;
+            }
+        }
+        recompute();
+    }
+
+  private:
+    bool sourcesChanged() {
+        for (auto& source : sources) {
+            source.slot->refresh();
+            if (source.changed()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void recompute() {
+        if (evaluating) {
+            throw std::runtime_error("computed(): value depends on itself");
+        }
+        ReadTracker tracker;
+        std::optional<T> next;
+        {
+            struct ClearOnExit {
+                bool& flag;
+                ~ClearOnExit() {
+                    flag = false;
+                }
+            } clear{evaluating};
+            evaluating = true;
+            TrackingScope scope(&tracker);
+            next.emplace(computeFn());
+        }
+
+        for (auto& source : sources) {
+            source.slot->unsubscribe(this);
+        }
+        sources = std::move(tracker.reads);
+        for (auto& source : sources) {
+            source.slot->subscribe(this);
+        }
+
+        if (!value || valuesDiffer(*value, *next)) {
+            value = std::move(next);
+            ++version;
+        }
+        stale = false;
+    }
+};
+}  // namespace Detail
+
+// Handle to a Node::computed() value. get() evaluates on demand and, called while another
+// computed is evaluating, becomes one of its sources.
+template <typename T>
+struct Computed {
+    std::shared_ptr<Detail::ComputedSlot<T>> slot;
+
+    Computed() = default;
+    explicit Computed(std::shared_ptr<Detail::ComputedSlot<T>> s) : slot(std::move(s)) {
+    }
+
+    const T& get() const {
+        if (!slot) {
+            throw std::runtime_error("Accessing uninitialized computed via get()");
+        }
+        slot->refresh();
+        Detail::trackRead(slot);
+        return *slot->value;
+    }
+    // get() without becoming a dependency of whatever is running.
+    const T& peek() const {
+        if (!slot) {
+            throw std::runtime_error("Accessing uninitialized computed via peek()");
+        }
+        slot->refresh();
+        return *slot->value;
+    }
+
+    bool isValid() const {
+        return slot != nullptr;
+    }
+};
+
+//------------------------------------------------------------------------------
+// Context
+//------------------------------------------------------------------------------
+namespace Detail {
+// What a consuming node holds for one use<T>(): the provider's state once it has been found,
+// and nothing before. Binding happens on attach and when a provider above changes, so a read
+// never searches the tree.
+struct ContextCellBase {
+    const void* typeKey;
+    const BaseStateSlot* slot = nullptr;  // The provider's, once bound
+    bool resolved = false;
+
+    explicit ContextCellBase(const void* key) : typeKey(key) {
+    }
+    virtual ~ContextCellBase() = default;
+    virtual void bind(const std::shared_ptr<BaseStateSlot>& slot) = 0;
+};
+
+template <typename T>
+struct ContextCell final : ContextCellBase {
+    State<T> state;
+
+    ContextCell() : ContextCellBase(Detail::typeKey<T>()) {
+    }
+
+    void bind(const std::shared_ptr<BaseStateSlot>& provided) override {
+        state = State<T>(std::static_pointer_cast<TypedStateSlot<T>>(provided));
+        slot = provided.get();
+        resolved = true;
+    }
+};
+
+// One provide<T>() entry on the providing node.
+struct ProvidedContext {
+    const void* typeKey;
+    std::shared_ptr<BaseStateSlot> slot;
+};
+}  // namespace Detail
+
+// Handle returned by Node::use(). Reads and writes go to the nearest provider's state, which
+// is looked up when the node is attached below it; using the handle before then throws. A
+// detached node keeps its last provider until it is attached again.
+template <typename T>
+struct Context {
+    std::shared_ptr<Detail::ContextCell<T>> cell;
+
+    Context() = default;
+    explicit Context(std::shared_ptr<Detail::ContextCell<T>> c) : cell(std::move(c)) {
+    }
+
+    const T& get() const {
+        return provided().get();
+    }
+    const T& peek() const {
+        return provided().peek();
+    }
+    void set(T newVal) const {
+        provided().set(std::move(newVal));
+    }
+    // The provider's state itself, e.g. to list it as an explicit dependency.
+    State<T> state() const {
+        return provided();
+    }
+
+    bool isResolved() const {
+        return cell && cell->resolved;
+    }
+
+  private:
+    State<T>& provided() const {
+        if (!cell || !cell->state.isValid()) {
+            throw std::runtime_error("Context: no provider above this node (yet)");
+        }
+        return cell->state;
+    }
+};
+
+//------------------------------------------------------------------------------
+// Spatial Culling
+//------------------------------------------------------------------------------
+namespace Detail {
+class SpatialIndex;
+}
+
+// A Node::bounds() rect. Subscribes to it so the index only re-bins the boxes that moved.
+struct BoundsHook : Detail::ISubscriber {
+    struct Placement {
+        Detail::SpatialIndex* index;
+        uint32_t box;  // Position in that index
+    };
+
+    State<SDL_FRect> rect;
+    // The traversal roots that have it indexed, usually one. A node under two rendered roots
+    // (a subtree also drawn on its own, say) has a box in each.
+    std::vector<Placement> placements;
+
+    explicit BoundsHook(State<SDL_FRect> r) : rect(std::move(r)) {
+        rect.slot->subscribe(this);
+    }
+    ~BoundsHook() override;
+    BoundsHook(const BoundsHook&) = delete;
+    BoundsHook& operator=(const BoundsHook&) = delete;
+
+    const Placement* placementIn(const Detail::SpatialIndex* index) const {
+        for (const Placement& placement : placements) {
+            if (placement.index == index) {
+                return &placement;
+            }
+        }
+        return nullptr;
+    }
+
+    void unplace(const Detail::SpatialIndex* index) {
+        std::erase_if(placements, [index](const Placement& p) { return p.index == index; });
+    }
+
+    void markDirty() override;
+};
+
+namespace Detail {
+// Hash grid of node bounds, one per traversal root next to its phase lists. A box is binned
+// into every cell it touches, and boxes that moved since the last query are re-binned first,
+// so a query costs the cells it covers plus whatever moved, not the number of boxes.
+class SpatialIndex {
+  public:
+    static constexpr float CELL_SIZE = 256.0f;
+    // Boxes touching more cells than this are kept in a side list and tested on every query.
+    static constexpr int64_t MAX_CELLS_PER_BOX = 64;
+
+    struct Box {
+        BoundsHook* hook;  // Null once the hook is gone
+        SDL_FRect rect;
+        int32_t cellX0, cellY0, cellX1, cellY1;  // Inclusive
+        bool oversized;
+        uint32_t renderBegin;  // The node's entries in PhaseLists::renderFns
+        uint32_t renderEnd;
+        uint64_t stamp;  // Last query that found it
+        bool moved;      // Queued for refresh()
+    };
+
+    SpatialIndex() = default;
+    SpatialIndex(const SpatialIndex&) = delete;
+    SpatialIndex& operator=(const SpatialIndex&) = delete;
+    ~SpatialIndex() {
+        clear();
+    }
+
+    bool empty() const {
+        return _boxes.empty();
+    }
+
+    // Each root indexes its own nodes, so this never touches another root's index (whose
+    // phase lists would otherwise still point at a box it no longer has).
+    void add(BoundsHook& hook, uint32_t renderBegin, uint32_t renderEnd) {
+        const auto box = static_cast<uint32_t>(_boxes.size());
+        hook.placements.push_back({this, box});
+        _boxes.push_back(
+            {&hook, hook.rect.peek(), 0, 0, 0, 0, false, renderBegin, renderEnd, 0, false}
+        );
+        bin(box);
+    }
+
+    void clear() {
+        for (Box& box : _boxes) {
+            if (box.hook) {
+                box.hook->unplace(this);
+            }
+        }
+        _boxes.clear();
+        _cells.clear();
+        _oversized.clear();
+        _moved.clear();
+    }
+
+    void markMoved(uint32_t index) {
+        if (!_boxes[index].moved) {
+            _boxes[index].moved = true;
+            _moved.push_back(index);
+        }
+    }
+
+    // Drops the box of a hook that is going away.
+    void forget(uint32_t index) {
+        if (_boxes[index].moved) {
+            _moved.erase(std::find(_moved.begin(), _moved.end(), index));
+        }
+        unbin(index);
+        _boxes[index].hook = nullptr;
+        _boxes[index].moved = false;
+    }
+
+    // Re-bins the boxes whose rect was written since the last call.
+    void refresh() {
+        for (uint32_t index : _moved) {
+            Box& box = _boxes[index];
+            box.moved = false;
+            box.rect = box.hook->rect.peek();
+            Box placed = box;
+            place(placed);
+            if (placed.oversized != box.oversized || placed.cellX0 != box.cellX0 ||
+                placed.cellY0 != box.cellY0 || placed.cellX1 != box.cellX1 ||
+                placed.cellY1 != box.cellY1) {
+                unbin(index);
+                bin(index);
+            }
+        }
+        _moved.clear();
+    }
+
+    // Calls visit(box) once for every box overlapping `area`, edges included, and marks it as
+    // found by this query (see culled()).
+    template <typename Visit>
+    void query(const SDL_FRect& area, Visit&& visit) {
+        ++_stamp;
+        auto test = [&](uint32_t index) {
+            Box& box = _boxes[index];
+            if (box.stamp != _stamp && box.rect.x <= area.x + area.w &&
+                box.rect.x + box.rect.w >= area.x && box.rect.y <= area.y + area.h &&
+                box.rect.y + box.rect.h >= area.y) {
+                box.stamp = _stamp;
+                visit(static_cast<const Box&>(box));
+            }
+        };
+        for (uint32_t index : _oversized) {
+            test(index);
+        }
+        Box range{};
+        range.rect = area;
+        place(range);
+        const int64_t areaCells = (int64_t(range.cellX1) - range.cellX0 + 1) *
+                                  (int64_t(range.cellY1) - range.cellY0 + 1);
+        if (range.oversized || areaCells > static_cast<int64_t>(_cells.size())) {
+            // Covers more cells than are occupied; walking the occupied ones is cheaper
+            for (const auto& [key, entries] : _cells) {
+                for (uint32_t index : entries) {
+                    test(index);
+                }
+            }
+            return;
+        }
+        for (int32_t y = range.cellY0; y <= range.cellY1; ++y) {
+            for (int32_t x = range.cellX0; x <= range.cellX1; ++x) {
+                auto cell = _cells.find(cellKey(x, y));
+                if (cell != _cells.end()) {
+                    for (uint32_t index : cell->second) {
+                        test(index);
+                    }
+                }
+            }
+        }
+    }
+
+    // Whether the last query left this hook's node out.
+    bool culled(const BoundsHook& hook) const {
+        const BoundsHook::Placement* placement = hook.placementIn(this);
+        return placement && _boxes[placement->box].stamp != _stamp;
+    }
+
+  private:
+    std::vector<Box> _boxes;
+    // Emptied cells are kept, so boxes that move back and forth don't reallocate them
+    std::unordered_map<uint64_t, std::vector<uint32_t>> _cells;
+    std::vector<uint32_t> _oversized;
+    std::vector<uint32_t> _moved;
+    uint64_t _stamp = 0;
+
+    static uint64_t cellKey(int32_t x, int32_t y) {
+        return (uint64_t(uint32_t(x)) << 32) | uint32_t(y);
+    }
+
+    // Fills in the cell range for box.rect. Rects too big for the grid, or not finite, are
+    // marked oversized.
+    static void place(Box& box) {
+        const SDL_FRect& r = box.rect;
+        const double x0 = std::floor(r.x / CELL_SIZE);
+        const double y0 = std::floor(r.y / CELL_SIZE);
+        const double x1 = std::floor((r.x + r.w) / CELL_SIZE);
+        const double y1 = std::floor((r.y + r.h) / CELL_SIZE);
+        const double limit = static_cast<double>(INT32_MAX);
+        box.oversized = !(x0 >= -limit && y0 >= -limit && x1 <= limit && y1 <= limit) ||
+                        (x1 - x0 + 1.0) * (y1 - y0 + 1.0) > MAX_CELLS_PER_BOX;
+        if (!box.oversized) {
+            box.cellX0 = static_cast<int32_t>(x0);
+            box.cellY0 = static_cast<int32_t>(y0);
+            box.cellX1 = std::max(static_cast<int32_t>(x1), box.cellX0);
+            box.cellY1 = std::max(static_cast<int32_t>(y1), box.cellY0);
+        }
+    }
+
+    void bin(uint32_t index) {
+        Box& box = _boxes[index];
+        place(box);
+        if (box.oversized) {
+            _oversized.push_back(index);
+            return;
+        }
+        for (int32_t y = box.cellY0; y <= box.cellY1; ++y) {
+            for (int32_t x = box.cellX0; x <= box.cellX1; ++x) {
+                _cells[cellKey(x, y)].push_back(index);
+            }
+        }
+    }
+
+    void unbin(uint32_t index) {
+        const Box& box = _boxes[index];
+        auto removeFrom = [index](std::vector<uint32_t>& entries) {
+            auto it = std::find(entries.begin(), entries.end(), index);
+            if (it != entries.end()) {
+                *it = entries.back();
+                entries.pop_back();
+            }
+        };
+        if (box.oversized) {
+            removeFrom(_oversized);
+            return;
+        }
+        for (int32_t y = box.cellY0; y <= box.cellY1; ++y) {
+            for (int32_t x = box.cellX0; x <= box.cellX1; ++x) {
+                removeFrom(_cells[cellKey(x, y)]);
+            }
+        }
+    }
+};
+}  // namespace Detail
+
+inline BoundsHook::~BoundsHook() {
+    rect.slot->unsubscribe(this);
+    for (const Placement& placement : placements) {
+        placement.index->forget(placement.box);
+    }
+}
+
+inline void BoundsHook::markDirty() {
+    for (const Placement& placement : placements) {
+        placement.index->markMoved(placement.box);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Resources
+//------------------------------------------------------------------------------
+enum class ResourceStatus : uint8_t { Loading, Ready, Failed };
+
+// What a Node::resource() state holds. Everything that asked for the same asset shares one
+// copy, released when the last holder lets go.
+template <typename T>
+struct Asset {
+    ResourceStatus status = ResourceStatus::Loading;
+    std::shared_ptr<T> pointer;
+
+    T* get() const {
+        return pointer.get();
+    }
+    bool ready() const {
+        return status == ResourceStatus::Ready;
+    }
+};
+
+// Specialize for each type Node::resource() can load:
+//
+//   using Staged = ...;  // What the worker hands over; copyable, e.g. a pointer
+//   static Staged load(const std::string& path, Params...);   // On a worker, so thread-safe
+//   static T* finish(Staged staged, SDL_Renderer* renderer);  // Main thread; nullptr if failed
+//   static void destroy(T* value);                            // Main thread
+//   static void discard(Staged staged);                       // Any thread; nobody wants it
+//
+// Failures are logged by the loader, on the thread that saw them.
+template <typename T>
+struct ResourceLoader;
+
+// BMP files, decoded on the worker and uploaded to the cache's renderer on the main thread.
+template <>
+struct ResourceLoader<SDL_Texture> {
+    using Staged = SDL_Surface*;
+
+    static SDL_Surface* load(const std::string& path) {
+        SDL_Surface* surface = SDL_LoadBMP(path.c_str());
+        if (!surface) {
+            SDL_LogWarn(
+                SDL_LOG_CATEGORY_APPLICATION,
+                "Failed to load '%s': %s",
+                path.c_str(),
+                SDL_GetError()
+            );
+        }
+        return surface;
+    }
+
+    static SDL_Texture* finish(SDL_Surface* surface, SDL_Renderer* renderer) {
+        SDL_Texture* texture = nullptr;
+        if (surface && !renderer) {
+            SDL_LogWarn(
+                SDL_LOG_CATEGORY_APPLICATION,
+                "Can't upload a texture: the ResourceCache was created without a renderer"
+            );
+        } else if (surface) {
+            texture = SDL_CreateTextureFromSurface(renderer, surface);
+            if (!texture) {
+                SDL_LogWarn(
+                    SDL_LOG_CATEGORY_APPLICATION,
+                    "SDL_CreateTextureFromSurface failed: %s",
+                    SDL_GetError()
+                );
+            }
+        }
+        discard(surface);
+        return texture;
+    }
+
+    static void destroy(SDL_Texture* texture) {
+        SDL_DestroyTexture(texture);
+    }
+
+    static void discard(SDL_Surface* surface) {
+        if (surface) {
+            SDL_DestroySurface(surface);
+        }
+    }
+};
+
+namespace Detail {
+// One asset in a ResourceCache, shared by every node that asked for it.
+template <typename T>
+struct ResourceEntry {
+    ResourceStatus status = ResourceStatus::Loading;
+    std::shared_ptr<T> value;
+    std::vector<std::weak_ptr<TypedStateSlot<Asset<T>>>> waiting;  // Told once it's loaded
+
+    Asset<T> asset() const {
+        return {status, value};
+    }
+
+    void complete(T* loaded) {
+        status = loaded ? ResourceStatus::Ready : ResourceStatus::Failed;
+        if (loaded) {
+            value = std::shared_ptr<T>(loaded, [](T* v) { ResourceLoader<T>::destroy(v); });
+        }
+        batch([&] {
+            for (auto& weak : waiting) {
+                if (auto slot = weak.lock()) {
+                    State<Asset<T>>(std::move(slot)).set(asset());
+                }
+            }
+        });
+        waiting.clear();
+    }
+};
+}  // namespace Detail
+
+// Loads assets on a pool's workers (WorkStealingPool::post) and finishes them on the main
+// thread in poll(), which the app calls once a frame. An asset is loaded once however many
+// nodes ask for it and stays cached while any of them (or a preload) holds it. Node::resource()
+// goes through the active cache; there is at most one at a time.
+class ResourceCache {
+  public:
+    explicit ResourceCache(WorkStealingPool& pool, SDL_Renderer* renderer = nullptr)
+        : _pool(pool)
+        , _renderer(renderer)
+        , _inbox(std::make_shared<Inbox>()) {
+        if (activeCache) {
+            throw std::runtime_error("ResourceCache: another cache is already active");
+        }
+        activeCache = this;
+    }
+
+    // Loads that finish after this are dropped on their worker.
+    ~ResourceCache() {
+        std::vector<std::function<void(bool)>> done;
+        {
+            std::lock_guard lock(_inbox->mutex);
+            _inbox->closed = true;
+            done.swap(_inbox->done);
+        }
+        for (auto& finish : done) {
+            finish(false);
+        }
+        activeCache = nullptr;
+    }
+
+    ResourceCache(const ResourceCache&) = delete;
+    ResourceCache& operator=(const ResourceCache&) = delete;
+
+    static ResourceCache& active() {
+        if (!activeCache) {
+            throw std::runtime_error("resource(): no ResourceCache has been created");
+        }
+        return *activeCache;
+    }
+
+    // The shared entry for `path` loaded with `params`, starting the load if nobody holds it.
+    template <typename T, typename... Params>
+    std::shared_ptr<Detail::ResourceEntry<T>> acquire(const std::string& path, Params... params) {
+        static_assert((std::is_arithmetic_v<Params> && ...), "resource parameters are numbers");
+        Detail::requireMainThreadTreeAccess("acquire()");
+        Key key{Detail::typeKey<T>(), path};
+        ((key.id += '\x1f', key.id += std::to_string(params)), ...);
+        auto found = _entries.find(key);
+        if (found != _entries.end()) {
+            if (auto existing = found->second.lock()) {
+                return std::static_pointer_cast<Detail::ResourceEntry<T>>(existing);
+            }
+        } else {
+            pruneExpired();
+            found = _entries.emplace(std::move(key), std::weak_ptr<void>{}).first;
+        }
+        std::weak_ptr<void>& cached = found->second;
+
+        auto entry = std::make_shared<Detail::ResourceEntry<T>>();
+        cached = entry;
+        ++_inFlight;
+        _pool.post([inbox = _inbox,
+                    weak = std::weak_ptr<Detail::ResourceEntry<T>>(entry),
+                    renderer = _renderer,
+                    path,
+                    params...]() {
+            auto staged = ResourceLoader<T>::load(path, params...);
+            {
+                std::lock_guard lock(inbox->mutex);
+                if (!inbox->closed) {
+                    inbox->done.push_back([weak, staged, renderer](bool keep) {
+                        auto owner = weak.lock();
+                        if (keep && owner) {
+                            owner->complete(ResourceLoader<T>::finish(staged, renderer));
+                        } else {
+                            ResourceLoader<T>::discard(staged);
+                        }
+                    });
+                    return;
+                }
+            }
+            ResourceLoader<T>::discard(staged);
+        });
+        return entry;
+    }
+
+    // Starts loading ahead of the nodes that will ask for it (the next scene, say) and keeps
+    // it until releasePreloaded().
+    template <typename T, typename... Params>
+    void preload(const std::string& path, Params... params) {
+        _preloaded.push_back(acquire<T>(path, params...));
+    }
+
+    void releasePreloaded() {
+        _preloaded.clear();
+    }
+
+    // Hands finished loads to their states. Call on the main thread, before the update.
+    void poll() {
+        Detail::requireMainThreadTreeAccess("poll()");
+        {
+            std::lock_guard lock(_inbox->mutex);
+            _finishing.swap(_inbox->done);
+        }
+        for (auto& finish : _finishing) {
+            --_inFlight;
+            finish(true);
+        }
+        _finishing.clear();
+    }
+
+    // Whether every load started so far has been through poll(), e.g. to end a loading screen.
+    bool idle() const {
+        return _inFlight == 0;
+    }
+
+  private:
+    struct Key {
+        const void* type;
+        std::string id;
+
+        bool operator==(const Key&) const = default;
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<std::string>{}(key.id) ^ std::hash<const void*>{}(key.type);
+        }
+    };
+    // Completed loads, filled by workers
+    struct Inbox {
+        std::mutex mutex;
+        std::vector<std::function<void(bool)>> done;
+        bool closed = false;
+    };
+
+    static inline ResourceCache* activeCache = nullptr;
+    static constexpr size_t MIN_PRUNE_SIZE = 16;
+
+    WorkStealingPool& _pool;
+    SDL_Renderer* _renderer;
+    std::shared_ptr<Inbox> _inbox;
+    std::unordered_map<Key, std::weak_ptr<void>, KeyHash> _entries;
+    std::vector<std::shared_ptr<void>> _preloaded;
+    std::vector<std::function<void(bool)>> _finishing;  // Scratch for poll()
+    size_t _inFlight = 0;
+    size_t _pruneAt = MIN_PRUNE_SIZE;
+
+    // Drops keys nobody holds any more, whenever the map has doubled since the last sweep, so
+    // it stays proportional to the live assets rather than to every key ever requested.
+    void pruneExpired() {
+        if (_entries.size() < _pruneAt) {
+            return;
+        }
+        std::erase_if(_entries, [](const auto& entry) { return entry.second.expired(); });
+        _pruneAt = std::max(MIN_PRUNE_SIZE, _entries.size() * 2);
+    }
+};
+
+//------------------------------------------------------------------------------
+// Flattened Phase Lists
+//------------------------------------------------------------------------------
+namespace Detail {
+// Bumped by anything that changes tree shape or registers a callback hook. Traversals compare
+// it against the epoch their lists were built at and rebuild only when it has moved.
+struct TreeEpoch {
+    static inline uint64_t current = 0;
+
+    static void bump() {
+        ++current;
+    }
+};
+
+// Hook totals for a node and everything below it, kept current incrementally (hook
+// registration, dirty marks and attach/detach walk the parent chain) so traversals can prune
+// subtrees that have nothing to run without visiting them.
+struct SubtreeCounts {
+    uint32_t updateHooks = 0;
+    uint32_t renderHooks = 0;
+    uint32_t eventHooks = 0;
+    uint32_t effectHooks = 0;
+    uint32_t dirtyEffects = 0;
+    uint32_t contexts = 0;         // use() cells
+    uint32_t pendingContexts = 0;  // Those still waiting for a provider
+
+    bool hasHooks() const {
+        return updateHooks + renderHooks + eventHooks + effectHooks > 0;
+    }
+
+    void add(const SubtreeCounts& other) {
+        updateHooks += other.updateHooks;
+        renderHooks += other.renderHooks;
+        eventHooks += other.eventHooks;
+        effectHooks += other.effectHooks;
+        dirtyEffects += other.dirtyEffects;
+        contexts += other.contexts;
+        pendingContexts += other.pendingContexts;
+    }
+
+    void subtract(const SubtreeCounts& other) {
+        updateHooks -= other.updateHooks;
+        renderHooks -= other.renderHooks;
+        eventHooks -= other.eventHooks;
+        effectHooks -= other.effectHooks;
+        dirtyEffects -= other.dirtyEffects;
+        contexts -= other.contexts;
+        pendingContexts -= other.pendingContexts;
+    }
+};
+
+// Every phase's callbacks for one root, in tree order, as parallel arrays of callback and
+// owning node. Built lazily by the traversals and rebuilt only after a topology change, so a
+// phase is a linear sweep rather than a recursive walk.
+struct PhaseLists {
+    uint64_t epoch = UINT64_MAX;
+    std::vector<HookFn<void(double)>*> updateFns;
+    std::vector<Node*> updateNodes;
+    std::vector<HookFn<void(SDL_Renderer*)>*> renderFns;
+    std::vector<Node*> renderNodes;
+    std::vector<HookFn<void(SDL_Event*)>*> eventFns;
+    std::vector<Node*> eventNodes;
+    std::vector<uint32_t> eventOrder;  // Tree-order position of each eventFns entry
+    // on()/onKey() listeners bucketed by event type, so a dispatch only visits listeners for
+    // its own type plus the catch-all event() hooks above.
+    struct TypedListener {
+        const EventListener* listener;
+        Node* node;
+        uint32_t order;
+    };
+    std::unordered_map<Uint32, std::vector<TypedListener>> typedListeners;
+    uint32_t nextEventOrder = 0;
+    std::vector<Node*> effectNodes;
+    // Runs of updateFns that belong to an isolated subtree, for the parallel update.
+    struct IsolatedRange {
+        uint32_t begin;
+        uint32_t end;
+        const Node* root;
+    };
+    std::vector<IsolatedRange> isolatedRanges;
+    std::vector<std::vector<std::function<void()>>> deferredWrites;  // Scratch, one per task
+    // For each effectNodes entry, the index of the first entry past that node's subtree.
+    std::vector<uint32_t> effectSubtreeEnd;
+    // Everything below the root that has hooks. A node removed mid-phase is kept alive (and
+    // skipped, since it is marked detached) until the next rebuild, so the arrays above never
+    // dangle.
+    std::vector<NodePtr> retained;
+    RenderList renderList;  // Reused every frame so its buffers stay allocated
+    // Ranges of renderFns, in tree order: those of nodes without bounds, which always draw,
+    // and per frame the ones that passed culling.
+    struct RenderRun {
+        uint32_t begin;
+        uint32_t end;
+    };
+    std::vector<RenderRun> unboundedRenderRuns;
+    std::vector<RenderRun> visibleRenderRuns;
+    // Bounds of the nodes above. Declared after `retained` so that it is destroyed first and
+    // lets go of their hooks before they can go away.
+    SpatialIndex spatialIndex;
+};
+}  // namespace Detail
+
+template <typename... Columns>
+class Batch;
+
+//------------------------------------------------------------------------------
+// Node (The core of the scene graph)
+//------------------------------------------------------------------------------
+struct Node
+#if FRP_INTRUSIVE_NODE_PTR
+    : Detail::IntrusiveRefCounted
+#endif
+{
+    Node* parent = nullptr;
+    std::vector<NodePtr> children;
+    HookData hookData;
+    // States this node provides to its subtree, see provide(). Searched only at mount time.
+    std::vector<Detail::ProvidedContext> providedContexts;
+    // Number of this node's effects that have been marked dirty and not yet run.
+    int dirtyEffectCount = 0;
+    // Set on a subtree when it is removed from its parent and cleared when it is attached
+    // again; traversals skip detached nodes that are still in their (stale) lists.
+    bool detached = false;
+    // Totals for this node and its descendants; see Detail::SubtreeCounts.
+    Detail::SubtreeCounts subtreeCounts;
+    // See isolate().
+    bool isolated = false;
+    // Only populated on nodes that have been traversed as a root.
+    std::unique_ptr<Detail::PhaseLists> phaseLists;
+#if FRP_PROFILE
+    // See setProfileLabel().
+    const char* profileLabel = nullptr;
+#endif
+
+    Node(Node* p = nullptr) : parent(p) {
+    }
+
+    Node(Node* p, std::initializer_list<NodePtr> kids_init) : parent(p) {
+        children.reserve(kids_init.size());
+        for (const NodePtr& kid_ptr : kids_init) {
+            AddChild(kid_ptr);
+        }
+    }
+
+    void AddChild(NodePtr child) {
+        Detail::requireMainThreadTreeAccess("AddChild()");
+        if (child) {
+            adopt(*child);
+            children.push_back(std::move(child));
+            Detail::TreeEpoch::bump();
+        }
+    }
+
+    void RemoveChild(const NodePtr& childToRemove) {
+        Detail::requireMainThreadTreeAccess("RemoveChild()");
+        if (!childToRemove) {
+            return;
+        }
+        children.erase(
+            std::remove_if(
+                children.begin(),
+                children.end(),
+                [&](const NodePtr& child) {
+                    if (child == childToRemove) {
+                        orphan(*child);
+                        return true;
+                    }
+                    return false;
+                }
+            ),
+            children.end()
+        );
+        Detail::TreeEpoch::bump();
+    }
+
+    void SetChildren(std::initializer_list<NodePtr> newChildrenList) {
+        Detail::requireMainThreadTreeAccess("SetChildren()");
+        for (NodePtr& oldChild : children) {
+            if (oldChild) {
+                orphan(*oldChild);
+            }
+        }
+        children.clear();
+        children.reserve(newChildrenList.size());
+        for (const NodePtr& child_ptr : newChildrenList) {
+            if (child_ptr) {
+                adopt(*child_ptr);
+                children.push_back(child_ptr);
+            }
+        }
+        Detail::TreeEpoch::bump();
+    }
+
+    void SetChildren(const std::vector<NodePtr>& newChildren) {
+        Detail::requireMainThreadTreeAccess("SetChildren()");
+        for (NodePtr& oldChild : children) {
+            if (oldChild) {
+                orphan(*oldChild);
+            }
+        }
+        children.clear();
+        children.reserve(newChildren.size());
+        for (const NodePtr& child_ptr : newChildren) {
+            if (child_ptr) {
+                adopt(*child_ptr);
+                children.push_back(child_ptr);
+            }
+        }
+        Detail::TreeEpoch::bump();
+    }
+
+    // A subtree always shares one detached value, so these only walk it when that flips.
+    void adopt(Node& child) {
+        child.parent = this;
+        if (child.detached != detached) {
+            child.setDetached(detached);
+        }
+        for (Node* ancestor = this; ancestor; ancestor = ancestor->parent) {
+            ancestor->subtreeCounts.add(child.subtreeCounts);
+        }
+        resolvePendingContexts(child);
+    }
+
+    // Binds the cell to the nearest provider of its type, this node included.
+    bool resolveContext(Detail::ContextCellBase& cell) const {
+        for (const Node* node = this; node; node = node->parent) {
+            for (const Detail::ProvidedContext& provided : node->providedContexts) {
+                if (provided.typeKey == cell.typeKey) {
+                    cell.bind(provided.slot);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Retries every use() cell in `root`'s subtree that has no provider yet. Subtrees without
+    // pending cells are skipped, so attaching fully resolved nodes costs nothing.
+    static void resolvePendingContexts(Node& root) {
+        if (root.subtreeCounts.pendingContexts == 0) {
+            return;
+        }
+        for (const auto& cell : root.hookData.contexts) {
+            const BaseStateSlot* previous = cell->slot;
+            if (!cell->resolved && root.resolveContext(*cell)) {
+                root.updateSubtreeCounts([](Detail::SubtreeCounts& counts) {
+                    --counts.pendingContexts;
+                });
+                if (previous && cell->slot != previous) {
+                    root.rerunTrackedHooks();
+                }
+            }
+        }
+        for (const NodePtr& child : root.children) {
+            resolvePendingContexts(*child);
+        }
+    }
+
+    // Rebinds every bound `typeKey` cell in `root`'s subtree to its nearest provider and binds
+    // the pending ones that now have one. For a provide() below existing consumers.
+    static void rebindContexts(Node& root, const void* typeKey) {
+        if (root.subtreeCounts.contexts == 0) {
+            return;
+        }
+        for (const auto& cell : root.hookData.contexts) {
+            if (cell->typeKey != typeKey) {
+                continue;
+            }
+            bool wasResolved = cell->resolved;
+            const BaseStateSlot* previous = cell->slot;
+            if (!root.resolveContext(*cell)) {
+                continue;
+            }
+            if (!wasResolved) {
+                root.updateSubtreeCounts([](Detail::SubtreeCounts& counts) {
+                    --counts.pendingContexts;
+                });
+            }
+            if (previous && cell->slot != previous) {
+                root.rerunTrackedHooks();
+            }
+        }
+        for (const NodePtr& child : root.children) {
+            rebindContexts(*child, typeKey);
+        }
+    }
+
+    // Marks the bound cells of a detached subtree pending again, so attaching it elsewhere
+    // binds them to the providers there. Subtrees without bound cells are skipped.
+    static void unbindContexts(Node& root) {
+        if (root.subtreeCounts.contexts == root.subtreeCounts.pendingContexts) {
+            return;
+        }
+        for (const auto& cell : root.hookData.contexts) {
+            if (cell->resolved) {
+                cell->resolved = false;
+                root.updateSubtreeCounts([](Detail::SubtreeCounts& counts) {
+                    ++counts.pendingContexts;
+                });
+            }
+        }
+        for (const NodePtr& child : root.children) {
+            unbindContexts(*child);
+        }
+    }
+
+    // Tracked hooks only watch the provider state their last run read, so a rebound context
+    // has to rerun them to pick up the new one.
+    void rerunTrackedHooks() {
+        for (const auto& effect : hookData.effects) {
+            if (effect->_tracked) {
+                effect->force();
+            }
+        }
+        for (const auto& derived : hookData.derived) {
+            if (derived->_tracked) {
+                derived->force();
+            }
+        }
+    }
+
+    static void orphan(Node& child) {
+        for (Node* ancestor = child.parent; ancestor; ancestor = ancestor->parent) {
+            ancestor->subtreeCounts.subtract(child.subtreeCounts);
+        }
+        child.parent = nullptr;
+        if (!child.detached) {
+            child.setDetached(true);
+        }
+        unbindContexts(child);
+    }
+
+    // Applies a change in this node's own hooks to its totals and every ancestor's.
+    template <typename F>
+    void updateSubtreeCounts(F&& change) {
+        for (Node* node = this; node; node = node->parent) {
+            change(node->subtreeCounts);
+        }
+    }
+
+    void setDetached(bool value) {
+        detached = value;
+        for (const NodePtr& child : children) {
+            child->setDetached(value);
+        }
+    }
+
+    // O(1) lookup for hot paths. Returns nullptr if the handle doesn't address a T here.
+    template <typename T>
+    TypedStateSlot<T>* getStateSlot(StateHandle<T> handle) const {
+        if (handle.index >= hookData.stateSlots.size()) {
+            return nullptr;
+        }
+        BaseStateSlot* baseSlot = hookData.stateSlots[handle.index].get();
+        if (baseSlot->typeKey != Detail::typeKey<T>()) {
+            return nullptr;
+        }
+        return static_cast<TypedStateSlot<T>*>(baseSlot);
+    }
+
+    // First slot holding a T. Linear, so prefer the StateHandle overload in loops.
+    template <typename T>
+    std::shared_ptr<TypedStateSlot<T>> getStateSlot() const {
+        for (const auto& baseSlotPtr : hookData.stateSlots) {
+            if (baseSlotPtr->typeKey == Detail::typeKey<T>()) {
+                return std::static_pointer_cast<TypedStateSlot<T>>(baseSlotPtr);
+            }
+        }
+        return nullptr;
+    }
+
+    //--------------------------------------------------------------------------
+    // Hook Methods
+    //--------------------------------------------------------------------------
+    // Declares that this subtree's update hooks only write state created inside it, and that
+    // no other isolated subtree reads that state during the update phase. The parallel
+    // updateTree may then run it on a worker: writes to outside state still work but are
+    // deferred to a commit step after the batch, and structural changes are not allowed.
+    void isolate() {
+        isolated = true;
+        Detail::TreeEpoch::bump();
+    }
+
+    // Names this node in profiler output; unlabelled nodes show up by hook kind. The string
+    // must outlive the node, so pass a literal. Does nothing unless FRP_PROFILE is set.
+    void setProfileLabel([[maybe_unused]] const char* label) {
+#if FRP_PROFILE
+        profileLabel = label;
+#endif
+    }
+
+    template <typename T>
+    State<T> state(const T& initialValue) {
+        Detail::requireMainThreadTreeAccess("state()");
+        auto typedSlot = Detail::makeStateSlot(initialValue, this);
+        typedSlot->index = static_cast<uint32_t>(this->hookData.stateSlots.size());
+        this->hookData.stateSlots.push_back(typedSlot);
+        return State<T>(typedSlot);
+    }
+
+    // Hook callables are forwarded into place (see HookFn): a temporary closure is moved in,
+    // never copied.
+    template <typename F>
+    void update(F&& fn) {
+        Detail::requireMainThreadTreeAccess("update()");
+        this->hookData.updateEffects.emplace_back(std::forward<F>(fn));
+        updateSubtreeCounts([](Detail::SubtreeCounts& counts) { ++counts.updateHooks; });
+        Detail::TreeEpoch::bump();
+    }
+
+    template <typename F>
+    void render(F&& fn) {
+        Detail::requireMainThreadTreeAccess("render()");
+        this->hookData.renderEffects.emplace_back(std::forward<F>(fn));
+        updateSubtreeCounts([](Detail::SubtreeCounts& counts) { ++counts.renderHooks; });
+        Detail::TreeEpoch::bump();
+    }
+
+    // Cached variant: see CachedRenderHook. Draws are replayed until a dependency changes.
+    template <typename F, typename FirstDep, typename... RestDeps>
+    void render(F&& fn, const FirstDep& firstDep, const RestDeps&... restDeps) {
+        Detail::requireMainThreadTreeAccess("render()");
+        auto hook = std::make_unique<CachedRenderHook>(std::forward<F>(fn));
+        addDependenciesToHook(*hook, firstDep, restDeps...);
+        this->hookData.renderEffects.emplace_back(
+            [hook = hook.get()](SDL_Renderer* renderer) { hook->render(renderer); }
+        );
+        this->hookData.cachedRenders.push_back(std::move(hook));
+        updateSubtreeCounts([](Detail::SubtreeCounts& counts) { ++counts.renderHooks; });
+        Detail::TreeEpoch::bump();
+    }
+
+    // The area this node's own render and event hooks cover, in render coordinates (the ones
+    // render hooks draw in, after logical presentation and scaling). renderTree skips the
+    // node's render hooks while the area is out of view, and pointer events (mouse motion,
+    // buttons and wheel) only reach its event hooks when they land in it; see eventTree for
+    // how their window positions are mapped. Key events, and the node's children, are
+    // unaffected. Writes to `rect` move the node in the spatial index, so culling follows it.
+    void bounds(const State<SDL_FRect>& rect) {
+        Detail::requireMainThreadTreeAccess("bounds()");
+        if (!rect.isValid()) {
+            throw std::runtime_error("bounds(): state is uninitialized");
+        }
+        this->hookData.bounds = std::make_unique<BoundsHook>(rect);
+        Detail::TreeEpoch::bump();
+    }
+
+    // Same, with the rect kept up to date as a derived() value.
+    template <typename F, typename... DepTypes>
+        requires std::invocable<F&>
+    State<SDL_FRect> bounds(F&& rectFn, const DepTypes&... deps) {
+        State<SDL_FRect> rect = derived(std::forward<F>(rectFn), deps...);
+        bounds(rect);
+        return rect;
+    }
+
+    template <typename F>
+    void event(F&& fn) {
+        Detail::requireMainThreadTreeAccess("event()");
+        this->hookData.eventEffects.emplace_back(std::forward<F>(fn));
+        updateSubtreeCounts([](Detail::SubtreeCounts& counts) { ++counts.eventHooks; });
+        Detail::TreeEpoch::bump();
+    }
+
+    // Like event(), but only called for events of `type`. Listeners are indexed by type, so
+    // events nobody listens for (mouse motion, say) cost nothing to dispatch.
+    template <typename F>
+    void on(Uint32 type, F&& fn) {
+        addEventListener(type, -1, std::forward<F>(fn));
+    }
+
+    // Key events for one scancode only; `type` picks press or release.
+    template <typename F>
+    void onKey(SDL_Scancode scancode, F&& fn, Uint32 type = SDL_EVENT_KEY_DOWN) {
+        addEventListener(type, static_cast<int>(scancode), std::forward<F>(fn));
+    }
+
+    // Runs `effectFn` on its first frame and again whenever a dependency has changed. With
+    // no `deps` it only runs on mount.
+    template <typename F, typename... DepTypes>
+    void effect(F&& effectFn, const DepTypes&... deps) {
+        Detail::requireMainThreadTreeAccess("effect()");
+        addEffect<false>(std::forward<F>(effectFn), deps...);
+    }
+
+    // An effect whose dependencies are tracked instead of listed: every state or computed
+    // get() during a run is recorded and becomes the set for the next one, so a branch not
+    // taken stops subscribing to what only it reads. Use peek() to read without subscribing.
+    template <typename F>
+    void trackedEffect(F&& effectFn) {
+        Detail::requireMainThreadTreeAccess("trackedEffect()");
+        addEffect<true>(std::forward<F>(effectFn));
+    }
+
+    template <bool Tracked, typename F, typename... DepTypes>
+    void addEffect(F&& effectFn, const DepTypes&... deps) {
+        auto eh = std::make_unique<EffectHook>(this, std::forward<F>(effectFn));
+        eh->_tracked = Tracked;
+        if constexpr (sizeof...(DepTypes) > 0) {
+            addDependenciesToHook(*eh, deps...);
+        }
+        updateSubtreeCounts([](Detail::SubtreeCounts& counts) { ++counts.effectHooks; });
+        eh->markDirty();  // Every effect runs once on its first frame
+        this->hookData.effects.push_back(std::move(eh));
+        Detail::TreeEpoch::bump();
+    }
+
+    // A state holding `computeFn()`, rewritten whenever a dependency changes. With no `deps`
+    // it keeps its initial value.
+    template <typename F, typename... DepTypes>
+    auto derived(F&& computeFn, const DepTypes&... deps) {
+        return addDerived<false>(std::forward<F>(computeFn), deps...);
+    }
+
+    // A derived() whose dependencies are tracked, as for trackedEffect().
+    template <typename F>
+    auto trackedDerived(F&& computeFn) {
+        return addDerived<true>(std::forward<F>(computeFn));
+    }
+
+    template <bool Tracked, typename F, typename... DepTypes>
+    auto addDerived(F&& computeFn, const DepTypes&... deps) {
+        using R = decltype(computeFn());
+        Detail::ReadTracker tracker;
+        R initialValue = [&] {
+            Detail::TrackingScope scope(Tracked ? &tracker : nullptr);
+            return computeFn();
+        }();
+        State<R> computedState = this->state<R>(initialValue);
+        auto dh = std::make_unique<DerivedHook>(
+            [computedState, computeFn = std::forward<F>(computeFn)]() mutable {
+                R newValue = computeFn();
+                computedState.set(newValue);
+            }
+        );
+        if constexpr (Tracked) {
+            dh->_tracked = true;
+            Detail::retrack(dh->_dependencies, tracker.reads, dh.get());
+        } else if constexpr (sizeof...(DepTypes) > 0) {
+            addDependenciesToHook(*dh, deps...);
+        }
+        dh->bindOutput(computedState.slot.get());
+        this->hookData.derived.push_back(std::move(dh));
+        return computedState;
+    }
+
+    // Lazy alternative to derived(): see Computed. Nothing runs until the first get(), sources
+    // are picked up from what the function reads, and while nobody reads the value a source
+    // write costs one dirty mark.
+    template <typename F>
+    auto computed(F&& computeFn) {
+        Detail::requireMainThreadTreeAccess("computed()");
+        using R = std::decay_t<std::invoke_result_t<F&>>;
+        auto slot = std::allocate_shared<Detail::ComputedSlot<R>>(
+            Detail::PoolAllocator<Detail::ComputedSlot<R>>{}, std::forward<F>(computeFn)
+        );
+        slot->owner = this;
+        this->hookData.computeds.push_back(slot);
+        return Computed<R>(std::move(slot));
+    }
+
+    // Makes `state` available to every use<T>() in this subtree, as an alternative to
+    // passing it down through each component. Consumers already bound to a provider further
+    // up, or to an earlier provide<T>() here, switch to `state`; hooks that listed the old
+    // state() as an explicit dependency keep watching it.
+    template <typename T>
+    void provide(const State<T>& state) {
+        Detail::requireMainThreadTreeAccess("provide()");
+        if (!state.isValid()) {
+            throw std::runtime_error("provide(): state is uninitialized");
+        }
+        auto it = std::find_if(
+            providedContexts.begin(),
+            providedContexts.end(),
+            [](const Detail::ProvidedContext& provided) {
+                return provided.typeKey == Detail::typeKey<T>();
+            }
+        );
+        if (it != providedContexts.end()) {
+            it->slot = state.slot;
+        } else {
+            providedContexts.push_back({Detail::typeKey<T>(), state.slot});
+        }
+        rebindContexts(*this, Detail::typeKey<T>());
+    }
+
+    // The state of the nearest provide<T>() above this node (or on it). Components usually
+    // call this before they are attached, so the lookup waits until the node is mounted under
+    // a provider and is then kept: reading the handle is a pointer dereference, never a
+    // search. The handle can't be an explicit dependency before that; read it from a
+    // trackedEffect() or trackedDerived() instead.
+    template <typename T>
+    Context<T> use() {
+        Detail::requireMainThreadTreeAccess("use()");
+        auto cell = std::allocate_shared<Detail::ContextCell<T>>(
+            Detail::PoolAllocator<Detail::ContextCell<T>>{}
+        );
+        this->hookData.contexts.push_back(cell);
+        bool resolved = resolveContext(*cell);
+        updateSubtreeCounts([resolved](Detail::SubtreeCounts& counts) {
+            ++counts.contexts;
+            counts.pendingContexts += resolved ? 0 : 1;
+        });
+        return Context<T>(std::move(cell));
+    }
+
+    // `path` loaded by the active ResourceCache on a worker, as a state that starts out
+    // Loading and turns Ready (or Failed) in the cache's poll(). Nodes asking for the same
+    // path and params share one load and one copy. `params` are whatever the type's
+    // ResourceLoader takes, e.g. the point size for a TTF_Font.
+    template <typename T, typename... Params>
+    State<Asset<T>> resource(const std::string& path, Params... params) {
+        Detail::requireMainThreadTreeAccess("resource()");
+        auto entry = ResourceCache::active().acquire<T>(path, params...);
+        State<Asset<T>> asset = this->state(entry->asset());
+        if (entry->status == ResourceStatus::Loading) {
+            entry->waiting.push_back(asset.slot);
+        }
+        this->hookData.resources.push_back(std::move(entry));
+        return asset;
+    }
+
+    template <typename F>
+    void addEventListener(Uint32 type, int scancode, F&& fn) {
+        Detail::requireMainThreadTreeAccess("on()");
+        this->hookData.eventListeners.push_back({type, scancode, std::forward<F>(fn)});
+        updateSubtreeCounts([](Detail::SubtreeCounts& counts) { ++counts.eventHooks; });
+        Detail::TreeEpoch::bump();
+    }
+
+    // A structure-of-arrays store for many homogeneous entities owned by this one node; see
+    // Batch.
+    template <typename... Columns>
+    std::shared_ptr<Batch<Columns...>> batch() {
+        Detail::requireMainThreadTreeAccess("batch()");
+        auto store = std::make_shared<Batch<Columns...>>(*this);
+        this->hookData.batches.push_back(store);
+        if constexpr (Batch<Columns...>::snapshotSupported) {
+            this->hookData.snapshotParts.push_back(store.get());
+        }
+        return store;
+    }
+};
+
+inline bool Detail::isInsideIsolation(const Node* owner) {
+    for (const Node* node = owner; node; node = node->parent) {
+        if (node == IsolationContext::root) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void EffectHook::markDirty() {
+    if (!_dirty) {
+        _dirty = true;
+        ++_owner->dirtyEffectCount;
+        _owner->updateSubtreeCounts([](Detail::SubtreeCounts& counts) { ++counts.dirtyEffects; });
+    }
+}
+
+inline void EffectHook::runIfChanged() {
+    if (!_dirty) {
+        return;
+    }
+    // Clear first so a write made by the effect itself re-marks it for the next pass.
+    _dirty = false;
+    --_owner->dirtyEffectCount;
+    _owner->updateSubtreeCounts([](Detail::SubtreeCounts& counts) { --counts.dirtyEffects; });
+
+    if (_isFirstRun || std::exchange(_forced, false) ||
+        Detail::anyDependencyChanged(_dependencies)) {
+        {
+            FRP_PROFILE_COUNT(EffectRuns);
+            FRP_PROFILE_HOOK(_owner, _owner->profileLabel, Effect);
+            _tracker.reads.clear();
+            Detail::TrackingScope scope(_tracked ? &_tracker : nullptr);
+            _effectFn();
+        }
+        if (_tracked) {
+            Detail::retrack(_dependencies, _tracker.reads, this);
+        } else {
+            Detail::updateLastValues(_dependencies);
+        }
+        _isFirstRun = false;
+    }
+}
+
+#if FRP_INTRUSIVE_NODE_PTR
+template <>
+inline void Detail::destroyIntrusive<Node>(Node* node) {
+    node->~Node();
+    Detail::PoolAllocator<Node>{}.deallocate(node, 1);
+}
+
+inline NodePtr createNode(Node* parent = nullptr) {
+    Detail::requireMainThreadTreeAccess("createNode()");
+    Node* memory = Detail::PoolAllocator<Node>{}.allocate(1);
+    return NodePtr(new (memory) Node(parent));
+}
+#else
+inline NodePtr createNode(Node* parent = nullptr) {
+    Detail::requireMainThreadTreeAccess("createNode()");
+    return std::allocate_shared<Node>(Detail::PoolAllocator<Node>{}, parent);
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Generic Props
+//------------------------------------------------------------------------------
+template <typename T>
+inline T val(const Prop<T>& prop) {
+    if (std::holds_alternative<T>(prop)) {
+        return std::get<T>(prop);
+    } else if (std::holds_alternative<State<T>>(prop)) {
+        const auto& state = std::get<State<T>>(prop);
+        if (state.isValid()) {
+            return state.get();
+        }
+    } else if (std::holds_alternative<std::function<T()>>(prop)) {
+        const auto& func = std::get<std::function<T()>>(prop);
+        if (func) {
+            return func();
+        }
+    }
+    throw std::runtime_error("Invalid Prop<T> state or uninitialized provider");
+}
+
+// Computed props are plain functions, so no dependency list can see them change.
+template <typename T>
+inline bool isComputed(const Prop<T>& prop) {
+    return std::holds_alternative<std::function<T()>>(prop);
+}
+
+// Calls fn with a const reference to the prop's current value. Constant and State props are
+// read in place; only a computed prop produces a temporary.
+template <typename T, typename F>
+inline decltype(auto) withVal(const Prop<T>& prop, F&& fn) {
+    if (const T* constant = std::get_if<T>(&prop)) {
+        return std::forward<F>(fn)(*constant);
+    } else if (const State<T>* state = std::get_if<State<T>>(&prop)) {
+        if (state->isValid()) {
+            return std::forward<F>(fn)(state->get());
+        }
+    } else if (const auto* func = std::get_if<std::function<T()>>(&prop)) {
+        if (*func) {
+            return std::forward<F>(fn)((*func)());
+        }
+    }
+    throw std::runtime_error("Invalid Prop<T> state or uninitialized provider");
+}
+
+// Whether the prop can never change. Constant strings, for one, can be rasterized once.
+template <typename T>
+inline bool isConstant(const Prop<T>& prop) {
+    return std::holds_alternative<T>(prop);
+}
+
+//------------------------------------------------------------------------------
+// Typed Props
+//------------------------------------------------------------------------------
+// Props whose kind is part of their type: a ConstProp, a State (or Computed) or a FnProp. A
+// component that takes its props as template parameters (see Text) then reads each one with a
+// plain load, a slot read or a call the compiler can inline, where Prop<T> dispatches on the
+// variant and calls through std::function. The val/withVal/isComputed/isConstant overloads
+// below match the Prop<T> ones above, so a component body reads the same either way, and
+// asProp<T>() accepts a Prop<T> unchanged as the type-erased fallback.
+template <typename T>
+struct ConstProp {
+    T value;
+};
+
+template <typename T>
+ConstProp(T) -> ConstProp<T>;
+
+// A callable returning the prop's value. Like a function in Prop<T>, it can't be tracked.
+template <typename F>
+struct FnProp {
+    F fn;
+};
+
+template <typename F>
+FnProp(F) -> FnProp<F>;
+
+template <typename T>
+inline const T& val(const ConstProp<T>& prop) {
+    return prop.value;
+}
+
+template <typename T>
+inline const T& val(const State<T>& prop) {
+    return prop.get();
+}
+
+template <typename F>
+inline decltype(auto) val(const FnProp<F>& prop) {
+    return prop.fn();
+}
+
+template <typename T>
+inline const T& val(const Computed<T>& prop) {
+    return prop.get();
+}
+
+template <typename T, typename F>
+inline decltype(auto) withVal(const ConstProp<T>& prop, F&& fn) {
+    return std::forward<F>(fn)(prop.value);
+}
+
+template <typename T, typename F>
+inline decltype(auto) withVal(const State<T>& prop, F&& fn) {
+    return std::forward<F>(fn)(prop.get());
+}
+
+template <typename G, typename F>
+inline decltype(auto) withVal(const FnProp<G>& prop, F&& fn) {
+    return std::forward<F>(fn)(prop.fn());
+}
+
+template <typename T, typename F>
+inline decltype(auto) withVal(const Computed<T>& prop, F&& fn) {
+    return std::forward<F>(fn)(prop.get());
+}
+
+template <typename T>
+constexpr bool isComputed(const ConstProp<T>&) {
+    return false;
+}
+
+template <typename T>
+constexpr bool isComputed(const State<T>&) {
+    return false;
+}
+
+template <typename F>
+constexpr bool isComputed(const FnProp<F>&) {
+    return true;
+}
+
+// A Computed is tracked like a State, unlike the untracked functions above.
+template <typename T>
+constexpr bool isComputed(const Computed<T>&) {
+    return false;
+}
+
+template <typename T>
+constexpr bool isConstant(const ConstProp<T>&) {
+    return true;
+}
+
+template <typename T>
+constexpr bool isConstant(const State<T>&) {
+    return false;
+}
+
+template <typename F>
+constexpr bool isConstant(const FnProp<F>&) {
+    return false;
+}
+
+template <typename T>
+constexpr bool isConstant(const Computed<T>&) {
+    return false;
+}
+
+// Turns a component argument into a typed prop for a T parameter: typed props and Prop<T>
+// pass through, callables become a FnProp and anything else is converted into a ConstProp.
+template <typename T, typename P>
+inline auto asProp(P&& prop) {
+    using Arg = std::decay_t<P>;
+    if constexpr (is_specialization<Arg, ConstProp>::value ||
+                  is_specialization<Arg, FnProp>::value || std::is_same_v<Arg, State<T>> ||
+                  std::is_same_v<Arg, Computed<T>> || std::is_same_v<Arg, Prop<T>>) {
+        return Arg(std::forward<P>(prop));
+    } else if constexpr (std::is_invocable_r_v<T, const Arg&>) {
+        return FnProp<Arg>{std::forward<P>(prop)};
+    } else {
+        return ConstProp<T>{T(std::forward<P>(prop))};
+    }
+}
+
+//------------------------------------------------------------------------------
+// Conditional Node
+//------------------------------------------------------------------------------
+inline NodePtr Conditional(State<bool> condition, NodePtr childComponent) {
+    auto node = createNode();
+    node->effect(
+        // The effect is owned by the node, so a raw back-pointer can't dangle
+        [node_ptr = node.get(), condition, childComponent]() mutable {
+            if (!childComponent) {
+                return;
+            }
+            bool isCurrentlyChild = false;
+            for (const auto& c : node_ptr->children) {
+                if (c == childComponent) {
                     isCurrentlyChild = true;
                     break;
                 }
             }
-            if (condition.get()) {
-                if (!isCurrentlyChild) {
-                    node_sptr->AddChild(childComponent);
+            if (condition.get()) {
+                if (!isCurrentlyChild) {
+                    node_ptr->AddChild(childComponent);
+                }
+            } else {
+                if (isCurrentlyChild) {
+                    node_ptr->RemoveChild(childComponent);
+                }
+            }
+        },
+        condition
+    );
+    return node;
+}
+
+//------------------------------------------------------------------------------
+// Fragment Component (Groups children without adding behavior)
+//------------------------------------------------------------------------------
+inline NodePtr Fragment(std::initializer_list<NodePtr> children_init) {
+    auto node = createNode();
+    for (const NodePtr& child_ptr : children_init) {
+        if (child_ptr) {
+            node->AddChild(child_ptr);
+        }
+    }
+    return node;
+}
+
+//------------------------------------------------------------------------------
+// Keyed List Component
+//------------------------------------------------------------------------------
+// One child per element of `items`, matched across changes by `keyFn(element)` like SolidJS's
+// <For>. A key that survives a change keeps its node, which receives the new element through
+// the State<T> it was rendered with; new keys are rendered with `renderFn(State<T>)`, missing
+// keys are detached, and everything else is only reordered. A surviving key's item state is
+// only written when its element compares unequal, so an unchanged element doesn't notify its
+// node; element types without operator== (or ChangeTraits<T>::equal) are written on every
+// change. Keys must be unique: a duplicate is left out, keeping the first element with that
+// key, and reported with a warning.
+//
+// With `recycleCapacity` > 0, up to that many detached entries (node, item state and map
+// node) are kept and handed to new keys through their item state instead of calling
+// renderFn, so steady spawn/despawn churn allocates nothing. Only use it when the rendered
+// component reacts to its item state rather than reading it once at construction.
+template <typename T, typename KeyFn, typename RenderFn>
+inline NodePtr For(
+    State<std::vector<T>> items,
+    KeyFn keyFn,
+    RenderFn renderFn,
+    size_t recycleCapacity = 0
+) {
+    using Key = std::decay_t<std::invoke_result_t<KeyFn&, const T&>>;
+    struct Entry {
+        State<T> item;
+        NodePtr node;
+        uint64_t seen = 0;    // Pass in which the key was still present
+        uint64_t placed = 0;  // Pass in which the entry took its place in the order
+    };
+    using EntryMap = std::unordered_map<Key, Entry>;
+    // Shared rather than captured by value: map node handles are move-only.
+    struct Reconciler {
+        EntryMap entries;
+        std::vector<typename EntryMap::node_type> spare;
+        std::vector<NodePtr> order;
+        std::vector<Node*> created;
+        uint64_t pass = 0;
+    };
+
+    auto node = createNode();
+    node->effect(
+        [node_ptr = node.get(),
+         items,
+         keyFn,
+         renderFn,
+         recycleCapacity,
+         list = std::make_shared<Reconciler>()]() mutable {
+            auto& [entries, spare, order, created, pass] = *list;
+            ++pass;
+            order.clear();
+            created.clear();
+            const std::vector<T>& values = items.get();
+
+            // Retire vanished keys first, so that their entries can serve this pass's new keys
+            for (const T& value : values) {
+                auto it = entries.find(keyFn(value));
+                if (it != entries.end()) {
+                    it->second.seen = pass;
+                }
+            }
+            for (auto it = entries.begin(); it != entries.end();) {
+                if (it->second.seen == pass) {
+                    ++it;
+                    continue;
                 }
-            } else {
-                if (isCurrentlyChild) {
-                    node_sptr->RemoveChild(childComponent);
+                if (it->second.node) {
+                    Node::orphan(*it->second.node);
+                }
+                if (spare.size() < recycleCapacity && it->second.node) {
+                    auto next = std::next(it);
+                    spare.push_back(entries.extract(it));
+                    it = next;
+                } else {
+                    it = entries.erase(it);
                 }
             }
+
+            bool changed = false;
+            bool duplicate = false;
+            for (const T& value : values) {
+                Key key = keyFn(value);
+                auto it = entries.find(key);
+                if (it == entries.end()) {
+                    if (!spare.empty()) {
+                        auto recycled = std::move(spare.back());
+                        spare.pop_back();
+                        recycled.key() = std::move(key);
+                        it = entries.insert(std::move(recycled)).position;
+                        it->second.item.set(value);
+                    } else {
+                        it = entries.try_emplace(std::move(key)).first;
+                        it->second.item = State<T>(Detail::makeStateSlot(value, node_ptr));
+                        it->second.node = renderFn(it->second.item);
+                    }
+                    if (it->second.node) {
+                        created.push_back(it->second.node.get());
+                    }
+                } else if (it->second.placed == pass) {
+                    duplicate = true;
+                    continue;
+                } else if (Detail::writeBackDiffers(it->second.item.peek(), value)) {
+                    it->second.item.set(value);
+                }
+                Entry& entry = it->second;
+                entry.seen = pass;
+                entry.placed = pass;
+                if (entry.node) {
+                    const size_t position = order.size();
+                    changed |= position >= node_ptr->children.size() ||
+                               node_ptr->children[position] != entry.node;
+                    order.push_back(entry.node);
+                }
+            }
+            changed |= order.size() != node_ptr->children.size();
+
+            for (Node* child : created) {
+                node_ptr->adopt(*child);
+            }
+            if (changed) {
+                node_ptr->children.swap(order);
+                order.clear();  // Drop the old vector's references, keep its capacity
+                Detail::TreeEpoch::bump();
+            }
+            if (duplicate) {
+                SDL_LogWarn(
+                    SDL_LOG_CATEGORY_APPLICATION,
+                    "For(): duplicate key in list; kept the first element with each key"
+                );
+            }
         },
-        condition
+        items
     );
     return node;
 }
 
 //------------------------------------------------------------------------------
-// Fragment Component (Groups children without adding behavior)
+// Component Pool
 //------------------------------------------------------------------------------
-inline NodePtr Fragment(std::initializer_list<NodePtr> children_init) {
-    auto node = std::make_shared<Node>();
-    for (const NodePtr& child_ptr : children_init) {
-        if (child_ptr) {
-            node->AddChild(child_ptr);
+// Recycles the nodes of one component factory. acquire() hands out an idle instance after
+// `reset` has re-initialized it in place for the new arguments (typically by writing its
+// state slots through StateHandles), and only calls `factory` when none is idle. Once
+// reserve() has warmed the pool up, a spawn/despawn cycle costs no allocation.
+template <typename... Args>
+class ComponentPool {
+  public:
+    using Factory = std::function<NodePtr(Args...)>;
+    using Reset = std::function<void(Node&, Args...)>;
+
+    ComponentPool(Factory factory, Reset reset)
+        : _factory(std::move(factory))
+        , _reset(std::move(reset)) {
+    }
+
+    NodePtr acquire(Args... args) {
+        if (_idle.empty()) {
+            return _factory(args...);
         }
+        NodePtr node = std::move(_idle.back());
+        _idle.pop_back();
+        _reset(*node, args...);
+        return node;
+    }
+
+    // The node must already have been removed from its parent.
+    void release(NodePtr node) {
+        if (!node) {
+            return;
+        }
+        if (node->parent) {
+            throw std::runtime_error("ComponentPool::release() on a node that is still attached");
+        }
+        _idle.push_back(std::move(node));
+    }
+
+    // Builds instances up front until `count` are idle.
+    void reserve(size_t count, Args... args) {
+        _idle.reserve(count);
+        while (_idle.size() < count) {
+            _idle.push_back(_factory(args...));
+        }
+    }
+
+    size_t idleCount() const {
+        return _idle.size();
+    }
+
+  private:
+    Factory _factory;
+    Reset _reset;
+    std::vector<NodePtr> _idle;
+};
+
+//------------------------------------------------------------------------------
+// Batched Entities
+//------------------------------------------------------------------------------
+using BatchId = uint32_t;
+
+// Entities that would otherwise each need a node, stored column by column so that one update
+// hook can sweep them with plain loops over contiguous arrays. Entries have stable ids; the
+// dense order changes on removal (the last entry moves into the gap).
+//
+// Two states make the store observable like any other: ids() changes when entries are added
+// or removed, and revision() when markChanged() is called after a sweep. Individual entries can
+// still get their own node, e.g. For(batch->ids(), ...) with each child reading its entry by
+// id and depending on revision().
+template <typename... Columns>
+class Batch : public Detail::SnapshotPart {
+  public:
+    template <size_t C>
+    using Column = std::tuple_element_t<C, std::tuple<Columns...>>;
+
+    explicit Batch(Node& owner)
+        : _ids(owner.state(std::vector<BatchId>{}))
+        , _revision(owner.state(uint64_t{0})) {
+    }
+
+    BatchId add(Columns... values) {
+        requireOwnerAccess("Batch::add()");
+        BatchId id;
+        if (!_freeIds.empty()) {
+            id = _freeIds.back();
+            _freeIds.pop_back();
+        } else {
+            id = static_cast<BatchId>(_denseIndex.size());
+            _denseIndex.push_back(NO_INDEX);
+        }
+        _denseIndex[id] = static_cast<uint32_t>(size());
+        pushColumns(std::index_sequence_for<Columns...>{}, std::move(values)...);
+        _ids.update([id](auto& ids) { ids.push_back(id); });
+        return id;
+    }
+
+    void remove(BatchId id) {
+        if (!contains(id)) {
+            return;
+        }
+        requireOwnerAccess("Batch::remove()");
+        const uint32_t index = _denseIndex[id];
+        const uint32_t last = static_cast<uint32_t>(size() - 1);
+        _denseIndex[_ids.peek()[last]] = index;
+        _ids.update([index](auto& ids) {
+            ids[index] = ids.back();
+            ids.pop_back();
+        });
+        swapRemoveColumns(std::index_sequence_for<Columns...>{}, index, last);
+        _denseIndex[id] = NO_INDEX;
+        _freeIds.push_back(id);
+    }
+
+    void clear() {
+        if (size() == 0) {
+            return;
+        }
+        requireOwnerAccess("Batch::clear()");
+        for (BatchId id : _ids.peek()) {
+            _denseIndex[id] = NO_INDEX;
+            _freeIds.push_back(id);
+        }
+        std::apply([](auto&... columns) { (columns.clear(), ...); }, _columns);
+        _ids.update([](auto& ids) { ids.clear(); });
+    }
+
+    // Bookkeeping reads peek, so a tracked hook that adds or clears doesn't subscribe to ids().
+    size_t size() const {
+        return _ids.peek().size();
+    }
+
+    bool contains(BatchId id) const {
+        return id < _denseIndex.size() && _denseIndex[id] != NO_INDEX;
     }
-    return node;
-}
+
+    // Position of `id` in the columns. Only valid until the next add() or remove().
+    size_t indexOf(BatchId id) const {
+        if (!contains(id)) {
+            throw std::runtime_error("Batch: no entry with this id");
+        }
+        return _denseIndex[id];
+    }
+
+    template <size_t C>
+    std::span<Column<C>> column() {
+        return std::get<C>(_columns);
+    }
+
+    template <size_t C>
+    std::span<const Column<C>> column() const {
+        return std::get<C>(_columns);
+    }
+
+    template <size_t C>
+    Column<C>& at(BatchId id) {
+        return std::get<C>(_columns)[indexOf(id)];
+    }
+
+    template <size_t C>
+    const Column<C>& at(BatchId id) const {
+        return std::get<C>(_columns)[indexOf(id)];
+    }
+
+    // Live ids in column order.
+    State<std::vector<BatchId>> ids() const {
+        return _ids;
+    }
+
+    State<uint64_t> revision() const {
+        return _revision;
+    }
+
+    // Column writes aren't tracked one by one; call this once after a sweep.
+    void markChanged() {
+        _revision.update([](uint64_t& revision) { ++revision; });
+    }
+
+    // Whether captureState() includes the columns; ids() and revision() are plain state.
+    static constexpr bool snapshotSupported =
+        (SnapshotTraits<std::vector<Columns>>::supported && ...);
+
+    void snapshotWrite(SnapshotWriter& out) const override {
+        if constexpr (snapshotSupported) {
+            std::apply(
+                [&](const auto&... columns) {
+                    (SnapshotTraits<std::decay_t<decltype(columns)>>::write(out, columns), ...);
+                },
+                _columns
+            );
+            SnapshotTraits<std::vector<uint32_t>>::write(out, _denseIndex);
+            SnapshotTraits<std::vector<BatchId>>::write(out, _freeIds);
+        }
+    }
+
+    void snapshotRead(SnapshotReader& in) override {
+        if constexpr (snapshotSupported) {
+            std::apply(
+                [&](auto&... columns) {
+                    (SnapshotTraits<std::decay_t<decltype(columns)>>::read(in, columns), ...);
+                },
+                _columns
+            );
+            SnapshotTraits<std::vector<uint32_t>>::read(in, _denseIndex);
+            SnapshotTraits<std::vector<BatchId>>::read(in, _freeIds);
+        }
+    }
+
+  private:
+    static constexpr uint32_t NO_INDEX = UINT32_MAX;
+
+    std::tuple<std::vector<Columns>...> _columns;
+    std::vector<uint32_t> _denseIndex;  // By id
+    std::vector<BatchId> _freeIds;
+    State<std::vector<BatchId>> _ids;
+    State<uint64_t> _revision;
+
+    // Columns and indices change in place, which can't be deferred like a state write, so an
+    // isolated update outside the owner's subtree may only read the store.
+    void requireOwnerAccess(const char* operation) const {
+        if (Detail::IsolationContext::active() && !Detail::isInsideIsolation(_ids.slot->owner)) {
+            Detail::requireMainThreadTreeAccess(operation);
+        }
+    }
+
+    template <size_t... C>
+    void pushColumns(std::index_sequence<C...>, Columns&&... values) {
+        (std::get<C>(_columns).push_back(std::move(values)), ...);
+    }
+
+    template <size_t... C>
+    void swapRemoveColumns(std::index_sequence<C...>, uint32_t index, uint32_t last) {
+        auto swapRemove = [&](auto& column) {
+            if (index != last) {
+                column[index] = std::move(column[last]);
+            }
+            column.pop_back();
+        };
+        (swapRemove(std::get<C>(_columns)), ...);
+    }
+};
 
 //------------------------------------------------------------------------------
 // Tree Traversal
 //------------------------------------------------------------------------------
+namespace Detail {
+// Effects may write state, which can dirty derived values and other effects (or mount new
+// children via Conditional). Settling repeats until quiet, capped so a feedback loop between
+// effects spreads over frames instead of hanging one.
+constexpr int MAX_SETTLE_PASSES = 16;
+
+inline void collectPhaseLists(PhaseLists& lists, Node* node, bool insideIsolated) {
+    const bool startsIsolatedRange = node->isolated && !insideIsolated;
+    const size_t isolatedBegin = lists.updateFns.size();
+    for (auto& fn : node->hookData.updateEffects) {
+        lists.updateFns.push_back(&fn);
+        lists.updateNodes.push_back(node);
+    }
+    const auto renderBegin = static_cast<uint32_t>(lists.renderFns.size());
+    for (auto& fn : node->hookData.renderEffects) {
+        lists.renderFns.push_back(&fn);
+        lists.renderNodes.push_back(node);
+    }
+    const auto renderEnd = static_cast<uint32_t>(lists.renderFns.size());
+    if (node->hookData.bounds) {
+        lists.spatialIndex.add(*node->hookData.bounds, renderBegin, renderEnd);
+    } else if (renderEnd > renderBegin) {
+        auto& runs = lists.unboundedRenderRuns;
+        if (!runs.empty() && runs.back().end == renderBegin) {
+            runs.back().end = renderEnd;
+        } else {
+            runs.push_back({renderBegin, renderEnd});
+        }
+    }
+    for (auto& fn : node->hookData.eventEffects) {
+        lists.eventFns.push_back(&fn);
+        lists.eventNodes.push_back(node);
+        lists.eventOrder.push_back(lists.nextEventOrder++);
+    }
+    for (const auto& listener : node->hookData.eventListeners) {
+        lists.typedListeners[listener.type].push_back({&listener, node, lists.nextEventOrder++});
+    }
+    const size_t effectEntry = lists.effectNodes.size();
+    if (!node->hookData.effects.empty()) {
+        lists.effectNodes.push_back(node);
+        lists.effectSubtreeEnd.push_back(0);
+    }
+    for (const NodePtr& child : node->children) {
+        // Hookless subtrees (static groups, plain containers) contribute nothing; skip them
+        if (child->subtreeCounts.hasHooks()) {
+            lists.retained.push_back(child);
+            collectPhaseLists(lists, child.get(), insideIsolated || node->isolated);
+        }
+    }
+    if (!node->hookData.effects.empty()) {
+        lists.effectSubtreeEnd[effectEntry] = static_cast<uint32_t>(lists.effectNodes.size());
+    }
+    if (startsIsolatedRange && lists.updateFns.size() > isolatedBegin) {
+        lists.isolatedRanges.push_back({
+            static_cast<uint32_t>(isolatedBegin),
+            static_cast<uint32_t>(lists.updateFns.size()),
+            node,
+        });
+    }
+}
+
+// Rebuilding is also the point where nodes removed during the previous phase are released.
+inline PhaseLists& phaseListsFor(Node& root) {
+    if (!root.phaseLists) {
+        root.phaseLists = std::make_unique<PhaseLists>();
+    }
+    PhaseLists& lists = *root.phaseLists;
+    if (lists.epoch != TreeEpoch::current) {
+        lists.spatialIndex.clear();
+        lists.unboundedRenderRuns.clear();
+        lists.retained.clear();
+        lists.updateFns.clear();
+        lists.updateNodes.clear();
+        lists.renderFns.clear();
+        lists.renderNodes.clear();
+        lists.eventFns.clear();
+        lists.eventNodes.clear();
+        lists.eventOrder.clear();
+        for (auto& [type, listeners] : lists.typedListeners) {
+            listeners.clear();  // Keep the buckets; event types rarely come and go
+        }
+        lists.nextEventOrder = 0;
+        lists.effectNodes.clear();
+        lists.effectSubtreeEnd.clear();
+        lists.isolatedRanges.clear();
+        collectPhaseLists(lists, &root, false);
+        lists.epoch = TreeEpoch::current;
+    }
+    return lists;
+}
+
+// Jumps over every subtree without a dirty effect, so a quiet frame costs O(dirty) rather
+// than O(nodes with effects).
+inline bool runDirtyEffects(const PhaseLists& lists) {
+    bool ranAny = false;
+    for (size_t entry = 0; entry < lists.effectNodes.size();) {
+        Node* node = lists.effectNodes[entry];
+        if (node->subtreeCounts.dirtyEffects == 0 || node->detached) {
+            entry = lists.effectSubtreeEnd[entry];
+            continue;
+        }
+        if (node->dirtyEffectCount > 0) {
+            auto& effects = node->hookData.effects;
+            for (size_t i = 0; i < effects.size(); ++i) {
+                ranAny |= effects[i]->_dirty;
+                effects[i]->runIfChanged();
+            }
+        }
+        ++entry;
+    }
+    return ranAny;
+}
+
+inline void runUpdateRange(const PhaseLists& lists, size_t begin, size_t end, double dt) {
+    for (size_t i = begin; i < end; ++i) {
+        if (!lists.updateNodes[i]->detached) {
+            FRP_PROFILE_HOOK(lists.updateNodes[i], lists.updateNodes[i]->profileLabel, Update);
+            (*lists.updateFns[i])(dt);
+        }
+    }
+}
+
+inline void settleTree(Node& root) {
+    FRP_PROFILE_PHASE(Settle);
+    // Bring derived values up to date before any effect gets to read them
+    for (int pass = 0; pass < MAX_SETTLE_PASSES; ++pass) {
+        DerivedScheduler::flush();
+        if (root.subtreeCounts.dirtyEffects == 0 || !runDirtyEffects(phaseListsFor(root))) {
+            break;
+        }
+    }
+}
+}  // namespace Detail
+
+// Nodes attached during a phase join in from the next phase; nodes removed during a phase
+// stop receiving callbacks immediately.
 inline void updateTree(const NodePtr& node, double dt) {
     if (!node) {
         return;
     }
-    // Run effects for the current node
-    for (auto& fn : node->hookData.updateEffects) {
-        fn(dt);
+    // Run update hooks for the whole tree first
+    if (node->subtreeCounts.updateHooks > 0) {
+        FRP_PROFILE_PHASE(Update);
+        const Detail::PhaseLists& lists = Detail::phaseListsFor(*node);
+        Detail::runUpdateRange(lists, 0, lists.updateFns.size(), dt);
+    }
+    Detail::settleTree(*node);
+}
+
+// Same as updateTree, except that sibling isolated subtrees (see Node::isolate) that sit next
+// to each other in tree order run their update hooks as one parallel batch on `pool`. Each
+// batch's deferred writes are committed in tree order before anything after it runs, so the
+// result doesn't depend on scheduling. Effects and derived values still settle on this thread.
+inline void updateTree(const NodePtr& node, double dt, WorkStealingPool& pool) {
+    if (!node) {
+        return;
     }
-    // Run useEffect hooks for the current node
-    for (auto& effectHook : node->hookData.effects) {
-        effectHook.runIfChanged();
+    if (node->subtreeCounts.updateHooks > 0) {
+        FRP_PROFILE_PHASE(Update);
+        Detail::PhaseLists& lists = Detail::phaseListsFor(*node);
+        const auto& ranges = lists.isolatedRanges;
+        std::vector<WorkStealingPool::Task> tasks;
+        size_t sequentialBegin = 0;
+        for (size_t first = 0; first < ranges.size();) {
+            Detail::runUpdateRange(lists, sequentialBegin, ranges[first].begin, dt);
+
+            size_t last = first + 1;
+            while (last < ranges.size() && ranges[last].begin == ranges[last - 1].end) {
+                ++last;
+            }
+            if (lists.deferredWrites.size() < last - first) {
+                lists.deferredWrites.resize(last - first);
+            }
+            tasks.clear();
+            for (size_t r = first; r < last; ++r) {
+                auto* log = &lists.deferredWrites[r - first];
+                log->clear();  // Left over if an earlier batch threw before committing
+                tasks.push_back([&lists, range = ranges[r], log, dt] {
+                    Detail::IsolationScope scope(range.root, log);
+                    Detail::runUpdateRange(lists, range.begin, range.end, dt);
+                });
+            }
+            pool.run(tasks);
+            for (size_t r = first; r < last; ++r) {
+                for (auto& write : lists.deferredWrites[r - first]) {
+                    write();
+                }
+                lists.deferredWrites[r - first].clear();
+            }
+
+            sequentialBegin = ranges[last - 1].end;
+            first = last;
+        }
+        Detail::runUpdateRange(lists, sequentialBegin, lists.updateFns.size(), dt);
     }
-    // Recursively update children
-    for (auto& child : node->children) {
-        updateTree(child, dt);
+    Detail::settleTree(*node);
+}
+
+namespace Detail {
+inline void runRenderRange(const PhaseLists& lists, size_t begin, size_t end, SDL_Renderer* r) {
+    for (size_t i = begin; i < end; ++i) {
+        if (!lists.renderNodes[i]->detached) {
+            FRP_PROFILE_HOOK(lists.renderNodes[i], lists.renderNodes[i]->profileLabel, Render);
+            (*lists.renderFns[i])(r);
+        }
     }
 }
 
-inline void renderTree(const NodePtr& node, SDL_Renderer* renderer) {
-    if (!node) {
+// With a view, render hooks of nodes whose bounds miss it are skipped (see Node::bounds).
+inline void renderLists(PhaseLists& lists, SDL_Renderer* renderer, const SDL_FRect* view) {
+    if (!view || lists.spatialIndex.empty()) {
+        runRenderRange(lists, 0, lists.renderFns.size(), renderer);
         return;
     }
-    // Run render effects for the current node
-    for (auto& fn : node->hookData.renderEffects) {
-        fn(renderer);
+    auto& runs = lists.visibleRenderRuns;
+    runs.assign(lists.unboundedRenderRuns.begin(), lists.unboundedRenderRuns.end());
+    lists.spatialIndex.refresh();
+    lists.spatialIndex.query(*view, [&](const SpatialIndex::Box& box) {
+        if (box.renderEnd > box.renderBegin) {
+            runs.push_back({box.renderBegin, box.renderEnd});
+        }
+    });
+    // Back into tree order. The flush groups each layer's draws by state, so this only keeps
+    // submission order stable among draws that share layer, kind, texture and color
+    std::sort(runs.begin(), runs.end(), [](const auto& a, const auto& b) {
+        return a.begin < b.begin;
+    });
+    for (const auto& run : runs) {
+        runRenderRange(lists, run.begin, run.end, renderer);
+    }
+}
+
+inline void renderTreeIn(
+    const NodePtr& node,
+    SDL_Renderer* renderer,
+    const SDL_FRect* view,
+    double alpha
+) {
+    if (!node || node->subtreeCounts.renderHooks == 0) {
+        return;
+    }
+    FRP_PROFILE_PHASE(Render);
+    PhaseLists& lists = phaseListsFor(*node);
+    lists.renderList.clear();
+    {
+        RenderRecordingScope recording(&lists.renderList);
+        RenderRecording::alpha = alpha;
+        renderLists(lists, renderer, view);
+    }
+    lists.renderList.flush(renderer);
+}
+
+// The area render hooks can reach, in the coordinates they draw in: the logical presentation
+// size when one is set, otherwise the viewport undone by the render scale. The output size in
+// pixels would disagree with both.
+inline bool renderView(SDL_Renderer* renderer, SDL_FRect& view) {
+    int width = 0;
+    int height = 0;
+    SDL_RendererLogicalPresentation mode = SDL_LOGICAL_PRESENTATION_DISABLED;
+    if (SDL_GetRenderLogicalPresentation(renderer, &width, &height, &mode) &&
+        mode != SDL_LOGICAL_PRESENTATION_DISABLED && width > 0 && height > 0) {
+        view = {0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height)};
+        return true;
+    }
+    SDL_Rect viewport;
+    float scaleX = 1.0f;
+    float scaleY = 1.0f;
+    if (!SDL_GetRenderViewport(renderer, &viewport) ||
+        !SDL_GetRenderScale(renderer, &scaleX, &scaleY) || scaleX <= 0.0f || scaleY <= 0.0f) {
+        return false;
+    }
+    view = {0.0f, 0.0f, viewport.w / scaleX, viewport.h / scaleY};
+    return true;
+}
+}  // namespace Detail
+
+// `alpha` is what renderAlpha() returns to the hooks; see FixedStepLoop::alpha(). Nodes with
+// bounds are culled against the area the renderer shows, in render coordinates (see
+// Detail::renderView); when that can't be determined nothing is culled.
+inline void renderTree(const NodePtr& node, SDL_Renderer* renderer, double alpha = 1.0) {
+    SDL_FRect view;
+    if (renderer && Detail::renderView(renderer, view)) {
+        Detail::renderTreeIn(node, renderer, &view, alpha);
+    } else {
+        Detail::renderTreeIn(node, renderer, nullptr, alpha);
+    }
+}
+
+// Same, culling against `view` instead, in the coordinates render hooks draw in: the visible
+// part of the world when the hooks apply a camera.
+inline void renderTree(
+    const NodePtr& node,
+    SDL_Renderer* renderer,
+    const SDL_FRect& view,
+    double alpha = 1.0
+) {
+    Detail::renderTreeIn(node, renderer, &view, alpha);
+}
+
+namespace Detail {
+// Where a pointer event happened, in render coordinates when a renderer is given (SDL reports
+// window coordinates). False for events without a position.
+inline bool pointerPosition(const SDL_Event& event, SDL_Renderer* renderer, SDL_FPoint& point) {
+    switch (event.type) {
+        case SDL_EVENT_MOUSE_MOTION:
+        case SDL_EVENT_MOUSE_BUTTON_DOWN:
+        case SDL_EVENT_MOUSE_BUTTON_UP:
+        case SDL_EVENT_MOUSE_WHEEL:
+            break;
+        default:
+            return false;
+    }
+    SDL_Event converted = event;
+    if (renderer) {
+        SDL_ConvertEventToRenderCoordinates(renderer, &converted);
     }
-    // Recursively render children
-    for (auto& child : node->children) {
-        renderTree(child, renderer);
+    if (converted.type == SDL_EVENT_MOUSE_MOTION) {
+        point = {converted.motion.x, converted.motion.y};
+    } else if (converted.type == SDL_EVENT_MOUSE_WHEEL) {
+        point = {converted.wheel.mouse_x, converted.wheel.mouse_y};
+    } else {
+        point = {converted.button.x, converted.button.y};
     }
+    return true;
 }
+}  // namespace Detail
 
-inline void eventTree(const NodePtr& node, SDL_Event* event) {
-    if (!node || !event) {
+// Pass the renderer the tree draws with, so pointer events are hit-tested against bounds in
+// its render coordinates. Without one their window positions are used as they are, which is
+// only right without logical presentation or scaling. Hooks always get the event unchanged.
+inline void eventTree(const NodePtr& node, SDL_Event* event, SDL_Renderer* renderer = nullptr) {
+    if (!node || !event || node->subtreeCounts.eventHooks == 0) {
         return;
     }
-    // Run event effects for the current node
-    for (auto& fn : node->hookData.eventEffects) {
-        fn(event);
+    FRP_PROFILE_PHASE(Event);
+    Detail::PhaseLists& lists = Detail::phaseListsFor(*node);
+    static const std::vector<Detail::PhaseLists::TypedListener> noListeners;
+    auto bucket = lists.typedListeners.find(event->type);
+    const auto& typed = bucket != lists.typedListeners.end() ? bucket->second : noListeners;
+    const bool isKey = event->type == SDL_EVENT_KEY_DOWN || event->type == SDL_EVENT_KEY_UP;
+
+    // A pointer event only reaches nodes with bounds that it lands in
+    SDL_FPoint point;
+    const bool hitTest =
+        !lists.spatialIndex.empty() && Detail::pointerPosition(*event, renderer, point);
+    if (hitTest) {
+        lists.spatialIndex.refresh();
+        lists.spatialIndex.query({point.x, point.y, 0.0f, 0.0f}, [](const auto&) {});
+    }
+    auto missed = [&](const Node* target) {
+        return hitTest && target->hookData.bounds &&
+               lists.spatialIndex.culled(*target->hookData.bounds);
+    };
+
+    // Merge the catch-all hooks with this type's listeners, in tree order
+    size_t i = 0;
+    size_t j = 0;
+    while (i < lists.eventFns.size() || j < typed.size()) {
+        const bool catchAllNext = i < lists.eventFns.size() &&
+                                  (j == typed.size() || lists.eventOrder[i] < typed[j].order);
+        if (catchAllNext) {
+            if (!lists.eventNodes[i]->detached && !missed(lists.eventNodes[i])) {
+                FRP_PROFILE_HOOK(lists.eventNodes[i], lists.eventNodes[i]->profileLabel, Event);
+                (*lists.eventFns[i])(event);
+            }
+            ++i;
+            continue;
+        }
+        const auto& entry = typed[j++];
+        if (entry.node->detached || missed(entry.node)) {
+            continue;
+        }
+        if (isKey && entry.listener->scancode >= 0 &&
+            entry.listener->scancode != static_cast<int>(event->key.scancode)) {
+            continue;
+        }
+        FRP_PROFILE_HOOK(entry.node, entry.node->profileLabel, Event);
+        entry.listener->fn(event);
+    }
+}
+
+//------------------------------------------------------------------------------
+// State Snapshots
+//------------------------------------------------------------------------------
+// The state of a tree in one contiguous buffer, for rollback and replays. `bytes` is an entry
+// count followed by the values in tree order (each node's state slots in hook order, then its
+// batches) and is all restoreState() needs for a tree of the same shape, including one rebuilt
+// by another run of the same build. `entries` remembers which slot each value came from, by a
+// snapshotId that is never reused, and the version it had, so captures and restores within a
+// run can skip slots nobody wrote since.
+//
+// Derived outputs and computed() values are left out; they follow from the state they read
+// and are recomputed after a restore. So is anything kept outside state slots and batches,
+// such as closure captures or a CollisionWorld's colliders.
+struct StateSnapshot {
+    // Batches have no version: column writes aren't tracked, so they are always re-encoded.
+    static constexpr uint64_t NO_VERSION = UINT64_MAX;
+
+    struct Entry {
+        uint64_t source;  // snapshotId of the slot or batch
+        uint64_t version;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    std::vector<uint8_t> bytes;
+    std::vector<Entry> entries;
+
+    // Keeps both buffers' capacity for the next capture.
+    void clear() {
+        bytes.clear();
+        entries.clear();
+    }
+};
+
+namespace Detail {
+inline bool isSnapshotted(const BaseStateSlot& slot) {
+    return slot.height == 0 && slot.snapshotSupported();
+}
+
+struct SnapshotCapture {
+    StateSnapshot& out;
+    const StateSnapshot* base;
+    SnapshotWriter writer;
+
+    void visit(const Node& node) {
+        for (const auto& slot : node.hookData.stateSlots) {
+            if (isSnapshotted(*slot)) {
+                add(slot->snapshotId, slot->version, [&] { slot->snapshotWrite(writer); });
+            }
+        }
+        for (const SnapshotPart* part : node.hookData.snapshotParts) {
+            add(part->snapshotId, StateSnapshot::NO_VERSION, [&] { part->snapshotWrite(writer); });
+        }
+        for (const NodePtr& child : node.children) {
+            visit(*child);
+        }
+    }
+
+    template <typename Encode>
+    void add(uint64_t source, uint64_t version, Encode&& encode) {
+        const auto offset = static_cast<uint32_t>(out.bytes.size());
+        const size_t index = out.entries.size();
+        if (base && index < base->entries.size() && version != StateSnapshot::NO_VERSION) {
+            const StateSnapshot::Entry& previous = base->entries[index];
+            if (previous.source == source && previous.version == version) {
+                writer.write(base->bytes.data() + previous.offset, previous.size);
+                out.entries.push_back({source, version, offset, previous.size});
+                return;
+            }
+        }
+        encode();
+        const auto size = static_cast<uint32_t>(out.bytes.size() - offset);
+        out.entries.push_back({source, version, offset, size});
+    }
+};
+
+struct SnapshotRestore {
+    const StateSnapshot& snapshot;
+    SnapshotReader reader;
+    size_t next = 0;
+
+    void visit(Node& node) {
+        for (const auto& slot : node.hookData.stateSlots) {
+            if (isSnapshotted(*slot) &&
+                restore(slot->snapshotId, slot->version, [&] { slot->snapshotRead(reader); })) {
+                slot->notifyChanged();
+            }
+        }
+        for (SnapshotPart* part : node.hookData.snapshotParts) {
+            restore(part->snapshotId, StateSnapshot::NO_VERSION, [&] {
+                part->snapshotRead(reader);
+            });
+        }
+        for (const NodePtr& child : node.children) {
+            visit(*child);
+        }
+    }
+
+    // Whether the value was decoded. With entries, a slot still at its captured version
+    // already holds the captured value and is skipped.
+    template <typename Decode>
+    bool restore(uint64_t source, uint64_t version, Decode&& decode) {
+        const size_t index = next++;
+        if (snapshot.entries.empty()) {
+            decode();
+            return true;
+        }
+        if (index >= snapshot.entries.size() || snapshot.entries[index].source != source) {
+            throw std::runtime_error("restoreState(): the tree changed since the snapshot");
+        }
+        const StateSnapshot::Entry& entry = snapshot.entries[index];
+        if (version != StateSnapshot::NO_VERSION && version == entry.version) {
+            return false;
+        }
+        reader.seek(entry.offset);
+        decode();
+        if (reader.offset() != entry.offset + entry.size) {
+            throw std::runtime_error("restoreState(): the tree changed since the snapshot");
+        }
+        return true;
+    }
+};
+}  // namespace Detail
+
+// Captures every state slot and batch under `root` into `out`, reusing its buffers. Values
+// whose slot still has the version it had in `base`, usually the previous frame's snapshot,
+// are copied from there instead of being encoded again.
+inline void captureState(
+    const NodePtr& root,
+    StateSnapshot& out,
+    const StateSnapshot* base = nullptr
+) {
+    Detail::requireMainThreadTreeAccess("captureState()");
+    if (base == &out) {
+        throw std::runtime_error("captureState(): base must be another snapshot");
+    }
+    out.clear();
+    if (base) {
+        out.bytes.reserve(base->bytes.size());
+        out.entries.reserve(base->entries.size());
+    }
+    uint32_t count = 0;
+    Detail::SnapshotCapture capture{out, base, SnapshotWriter(out.bytes)};
+    capture.writer.write(&count, sizeof(count));  // Patched once the tree is walked
+    capture.visit(*root);
+    count = static_cast<uint32_t>(out.entries.size());
+    std::memcpy(out.bytes.data(), &count, sizeof(count));
+}
+
+// Puts every state slot and batch under `root` back to its captured value, decoding in place.
+// Runs as one batch(): each restored state marks its dependents once, derived values are up to
+// date on return and effects see the restored values at the next update. The tree must have
+// the shape it had when captured (the same nodes and hooks); otherwise this throws, leaving
+// whatever was restored up to that point.
+inline void restoreState(const NodePtr& root, const StateSnapshot& snapshot) {
+    Detail::requireMainThreadTreeAccess("restoreState()");
+    Detail::SnapshotRestore restore{
+        snapshot,
+        SnapshotReader(snapshot.bytes.data(), snapshot.bytes.size()),
+    };
+    uint32_t count = 0;
+    restore.reader.read(&count, sizeof(count));
+    if (!snapshot.entries.empty() && count != snapshot.entries.size()) {
+        throw std::runtime_error("restoreState(): snapshot entries don't match its bytes");
     }
-    // Recursively process events for children
-    for (auto& child : node->children) {
-        eventTree(child, event);
+    batch([&] { restore.visit(*root); });
+    const bool consumed =
+        !snapshot.entries.empty() || restore.reader.offset() == snapshot.bytes.size();
+    if (restore.next != count || !consumed) {
+        throw std::runtime_error("restoreState(): the tree changed since the snapshot");
     }
 }
+
+//------------------------------------------------------------------------------
+// Fixed-Step Loop
+//------------------------------------------------------------------------------
+// Runs the simulation at a fixed rate regardless of the frame rate. Each frame hands advance()
+// the real time that passed; whole steps are taken out of the accumulated time and the
+// remainder becomes alpha(), which the frame passes to renderTree so render hooks can
+// interpolate between the previous and current step. A frame never runs more than
+// `maxStepsPerFrame` steps: after a stall the backlog is dropped rather than replayed, so a
+// slow frame can't snowball into slower ones.
+class FixedStepLoop {
+  public:
+    explicit FixedStepLoop(double stepsPerSecond = 120.0, int maxStepsPerFrame = 8)
+        : _step(1.0 / stepsPerSecond)
+        , _maxStepsPerFrame(maxStepsPerFrame) {
+        if (!(stepsPerSecond > 0.0) || maxStepsPerFrame < 1) {
+            throw std::runtime_error("FixedStepLoop: rate and step budget must be positive");
+        }
+    }
+
+    // Calls step(stepSeconds()) once per elapsed step. Returns how many steps ran.
+    template <typename StepFn>
+    int advance(double elapsedSeconds, StepFn&& step) {
+        _accumulator += std::max(elapsedSeconds, 0.0);
+        int steps = 0;
+        while (_accumulator >= _step && steps < _maxStepsPerFrame) {
+            step(_step);
+            _accumulator -= _step;
+            ++steps;
+        }
+        if (_accumulator >= _step) {
+            _accumulator = std::fmod(_accumulator, _step);
+        }
+        return steps;
+    }
+
+    int advance(const NodePtr& root, double elapsedSeconds) {
+        return advance(elapsedSeconds, [&root](double dt) { updateTree(root, dt); });
+    }
+
+    int advance(const NodePtr& root, double elapsedSeconds, WorkStealingPool& pool) {
+        return advance(elapsedSeconds, [&root, &pool](double dt) { updateTree(root, dt, pool); });
+    }
+
+    // Fraction of a step accumulated since the last one ran, in [0, 1).
+    double alpha() const {
+        return _accumulator / _step;
+    }
+
+    double stepSeconds() const {
+        return _step;
+    }
+
+  private:
+    double _step;
+    int _maxStepsPerFrame;
+    double _accumulator = 0.0;
+};
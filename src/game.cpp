@@ -1,9 +1,15 @@
 #include "game.hpp"
 
-NodePtr Game(TTF_Font* font) {
+NodePtr Game() {
     auto node = createNode(nullptr);
+    node->setProfileLabel("Game");
+
+    auto fontAsset = node->resource<TTF_Font>(FONT_PATH, FONT_POINT_SIZE);
+    // Null until the font has loaded, which Text treats as nothing to draw
+    auto font = node->derived([fontAsset]() { return fontAsset.get().get(); }, fontAsset);
 
     auto status = node->state(GameStatus::MainMenu);
+    node->provide(status);  // Bird and Pipes use() it
     auto score = node->state(0);
     auto birdRect = node->state(
         SDL_FRect{
@@ -14,20 +20,20 @@ NodePtr Game(TTF_Font* font) {
         }
     );
 
-    node->event([status, score](SDL_Event* e) mutable {
-        if (e->type == SDL_EVENT_KEY_DOWN) {
-            if (e->key.scancode == SDL_SCANCODE_SPACE || e->key.scancode == SDL_SCANCODE_UP) {
-                GameStatus currentStatus = status.get();
-                if (currentStatus == GameStatus::MainMenu) {
-                    status.set(GameStatus::Playing);
-                    score.set(0);
-                } else if (currentStatus == GameStatus::GameOver) {
-                    status.set(GameStatus::MainMenu);
-                    score.set(0);
-                }
+    auto advanceStatus = [status, score](SDL_Event*) mutable {
+        batch([&] {
+            GameStatus currentStatus = status.get();
+            if (currentStatus == GameStatus::MainMenu) {
+                status.set(GameStatus::Playing);
+                score.set(0);
+            } else if (currentStatus == GameStatus::GameOver) {
+                status.set(GameStatus::MainMenu);
+                score.set(0);
             }
-        }
-    });
+        });
+    };
+    node->onKey(SDL_SCANCODE_SPACE, advanceStatus);
+    node->onKey(SDL_SCANCODE_UP, std::move(advanceStatus));
 
     SDL_Color black = {0, 0, 0, 255};
 
@@ -35,8 +41,8 @@ NodePtr Game(TTF_Font* font) {
         Conditional(
             node->derived([status]() { return status.get() != GameStatus::GameOver; }, status),
             Fragment({
-                Pipes(status, birdRect, score),
-                Bird(status, birdRect),
+                Pipes(birdRect, score),
+                Bird(birdRect),
             })
         ),
         Conditional(
@@ -60,11 +66,15 @@ NodePtr Game(TTF_Font* font) {
             Text(
                 font,
                 black,
-                node->derived([score]() { return "Score: " + std::to_string(score.get()); }, score),
+                // Only formatted while the score is on screen
+                node->computed([score]() { return "Score: " + std::to_string(score.get()); }),
                 SDL_FPoint{WINDOW_WIDTH / 2.0f, 50.0f}
             )
         ),
     });
+#if FRP_PROFILE
+    node->AddChild(ProfilerOverlay(font));
+#endif
 
     return node;
 }
@@ -4,6 +4,7 @@
 #include <SDL3_ttf/SDL_ttf.h>
 
 #include "engine.hpp"
+#include "collision.hpp"
 
 //------------------------------------------------------------------------------
 // Window Constants
@@ -11,6 +12,10 @@
 constexpr int WINDOW_WIDTH = 384;
 constexpr int WINDOW_HEIGHT = 600;
 
+// The simulation runs at a fixed rate, independent of the display's refresh rate
+const double SIMULATION_STEPS_PER_SECOND = 120.0;
+const int MAX_SIMULATION_STEPS_PER_FRAME = 12;  // 0.1s of catch-up, like the old dt clamp
+
 //------------------------------------------------------------------------------
 // Flappy Bird Game Constants
 //------------------------------------------------------------------------------
@@ -27,6 +32,17 @@ const float PIPE_SPAWN_INTERVAL = 2.0f;  // seconds
 const int MIN_PIPE_HEIGHT = 80;
 const int MAX_PIPE_HEIGHT_OFFSET = WINDOW_HEIGHT - PIPE_GAP_HEIGHT - MIN_PIPE_HEIGHT * 2;
 
+// Draw order for the batched renderer, back to front
+constexpr int RENDER_LAYER_PIPES = 0;
+constexpr int RENDER_LAYER_BIRD = 1;
+constexpr int RENDER_LAYER_UI = 2;
+
+//------------------------------------------------------------------------------
+// Assets
+//------------------------------------------------------------------------------
+constexpr const char* FONT_PATH = "assets/arial.ttf";
+constexpr float FONT_POINT_SIZE = 24.0f;
+
 //------------------------------------------------------------------------------
 // Game Status Enum
 //------------------------------------------------------------------------------
@@ -35,5 +51,7 @@ enum class GameStatus { MainMenu, Playing, GameOver };
 #include "bird.hpp"
 #include "pipes.hpp"
 #include "text.hpp"
+#include "overlay.hpp"
 
-NodePtr Game(TTF_Font* font);
+// Loads its font through the active ResourceCache; text appears once it is ready.
+NodePtr Game();
@@ -0,0 +1,91 @@
+#include "overlay.hpp"
+
+#include <cstdio>
+
+//------------------------------------------------------------------------------
+// Profiler Overlay Component
+//------------------------------------------------------------------------------
+constexpr const char* PROFILE_TRACE_PATH = "frp_trace.json";
+constexpr float OVERLAY_LINE_HEIGHT = 26.0f;
+
+// Formats one overlay line from the last finished frame.
+static std::string overlayLine(int line) {
+    using namespace Profiling;
+    const FrameStats& frame = lastFrame();
+    char buffer[64];
+    switch (line) {
+        case 0:
+        case 1:
+        case 2:
+        case 3: {
+            Phase phase = static_cast<Phase>(line);
+            std::snprintf(buffer, sizeof(buffer), "%s %.3f ms", phaseName(phase), frame.ms(phase));
+            break;
+        }
+        case 4:
+            std::snprintf(
+                buffer,
+                sizeof(buffer),
+                "effects %llu  writes %llu",
+                static_cast<unsigned long long>(frame.count(Counter::EffectRuns)),
+                static_cast<unsigned long long>(frame.count(Counter::StateWrites))
+            );
+            break;
+        case 5:
+            std::snprintf(
+                buffer,
+                sizeof(buffer),
+                "allocations %llu",
+                static_cast<unsigned long long>(frame.count(Counter::Allocations))
+            );
+            break;
+        default: {
+            if (frame.nodes.empty()) {
+                return tracing() ? "tracing..." : "";
+            }
+            const NodeTiming& slowest = frame.nodes.front();
+            std::snprintf(
+                buffer,
+                sizeof(buffer),
+                "%s%s %.3f ms",
+                tracing() ? "* " : "",
+                slowest.label ? slowest.label : "(node)",
+                slowest.totalMs()
+            );
+            break;
+        }
+    }
+    return buffer;
+}
+
+NodePtr ProfilerOverlay(Prop<TTF_Font*> font) {
+    auto node = createNode();
+    node->setProfileLabel("ProfilerOverlay");
+    auto visible = node->state(false);
+
+    node->onKey(SDL_SCANCODE_F3, [visible](SDL_Event*) mutable { visible.set(!visible.get()); });
+    node->onKey(SDL_SCANCODE_F4, [](SDL_Event*) {
+        if (!Profiling::tracing()) {
+            Profiling::startTrace();
+        } else if (Profiling::stopTrace(PROFILE_TRACE_PATH)) {
+            SDL_Log("Wrote profile trace to %s", PROFILE_TRACE_PATH);
+        } else {
+            SDL_Log("Failed to write profile trace to %s", PROFILE_TRACE_PATH);
+        }
+    });
+
+    // Recomputed every frame; a callable prop keeps Text from caching its draw
+    SDL_Color white = {255, 255, 255, 255};
+    constexpr int LINE_COUNT = 7;
+    for (int line = 0; line < LINE_COUNT; ++line) {
+        float y = WINDOW_HEIGHT - OVERLAY_LINE_HEIGHT * (LINE_COUNT - line);
+        node->AddChild(Text(
+            font,
+            white,
+            [line] { return overlayLine(line); },
+            SDL_FPoint{WINDOW_WIDTH / 2.0f, y},
+            visible
+        ));
+    }
+    return node;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include "game.hpp"
+
+// Frame timings from the engine profiler, toggled with F3. F4 starts a trace capture and
+// writes it to frp_trace.json when pressed again. Game only adds it when FRP_PROFILE is set.
+NodePtr ProfilerOverlay(Prop<TTF_Font*> font);
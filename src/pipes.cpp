@@ -1,43 +1,75 @@
 #include "game.hpp"
 
 //------------------------------------------------------------------------------
-// Pipe Component
+// Pipe Store
 //------------------------------------------------------------------------------
-struct PipeData {
-    float xPos;
-    float topPipeHeight;
-    bool scored = false;
-    SDL_FRect topRect;
-    SDL_FRect bottomRect;
+// Every pipe lives in one batch owned by Pipes: x position before and after the last step, top
+// opening, whether it has already been scored and its two colliders, as contiguous columns.
+enum PipeColumn : size_t {
+    PIPE_PREV_X,
+    PIPE_X,
+    PIPE_OPENING_Y,
+    PIPE_SCORED,
+    PIPE_TOP_COLLIDER,
+    PIPE_BOTTOM_COLLIDER,
 };
+using PipeBatch = Batch<float, float, float, uint8_t, ColliderId, ColliderId>;
+
+// Collision layers: only bird/pipe pairs are ever tested.
+constexpr uint32_t COLLIDE_BIRD = 1u << 0;
+constexpr uint32_t COLLIDE_PIPE = 1u << 1;
+
+static void pipeRects(float xPos, float topPipeOpeningY, SDL_FRect& top, SDL_FRect& bottom) {
+    top = {xPos - PIPE_WIDTH / 2, 0, PIPE_WIDTH, topPipeOpeningY};
+    bottom = {
+        xPos - PIPE_WIDTH / 2,
+        topPipeOpeningY + PIPE_GAP_HEIGHT,
+        PIPE_WIDTH,
+        WINDOW_HEIGHT - (topPipeOpeningY + PIPE_GAP_HEIGHT),
+    };
+}
 
-NodePtr PipePair(float initialX, float topPipeOpeningY) {
+//------------------------------------------------------------------------------
+// Pipe Component
+//------------------------------------------------------------------------------
+// Draws one batch entry. The pipe list recycles these nodes, handing them a new id.
+NodePtr PipePair(std::shared_ptr<PipeBatch> pipes, State<BatchId> id) {
     auto node = createNode();
-    auto pipeData = node->state(
-        PipeData{
-            initialX,
-            topPipeOpeningY,
-            false,
-            {
-                initialX,
-                0,
-                PIPE_WIDTH,
-                topPipeOpeningY,
-            },
-            {
-                initialX,
-                topPipeOpeningY + PIPE_GAP_HEIGHT,
-                PIPE_WIDTH,
-                WINDOW_HEIGHT - (topPipeOpeningY + PIPE_GAP_HEIGHT),
-            },
-        }
+    node->setProfileLabel("PipePair");
+
+    // Both pipes span the full height, so the column swept over the last step is the pair's
+    // extent. Pipes spawn and leave just off screen, where this culls them.
+    node->bounds(
+        [pipes, id]() {
+            if (!pipes->contains(id.get())) {
+                return SDL_FRect{};  // Retired pair waiting to be recycled
+            }
+            size_t index = pipes->indexOf(id.get());
+            float prevX = pipes->column<PIPE_PREV_X>()[index];
+            float xPos = pipes->column<PIPE_X>()[index];
+            float left = std::min(prevX, xPos);
+            float right = std::max(prevX, xPos);
+            return SDL_FRect{left - PIPE_WIDTH / 2, 0, right - left + PIPE_WIDTH, WINDOW_HEIGHT};
+        },
+        id,
+        pipes->revision()
     );
 
-    node->render([pipeData](SDL_Renderer* renderer) {
-        PipeData data = pipeData.get();
-        SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);  // Green pipes
-        SDL_RenderFillRect(renderer, &data.topRect);
-        SDL_RenderFillRect(renderer, &data.bottomRect);
+    // Drawn between the last two steps, like the bird, so the pipes scroll smoothly too
+    node->render([pipes, id](SDL_Renderer* renderer) {
+        if (!pipes->contains(id.get())) {
+            return;
+        }
+        size_t index = pipes->indexOf(id.get());
+        float alpha = static_cast<float>(renderAlpha());
+        float prevX = pipes->column<PIPE_PREV_X>()[index];
+        float xPos = prevX + (pipes->column<PIPE_X>()[index] - prevX) * alpha;
+        SDL_FRect topRect;
+        SDL_FRect bottomRect;
+        pipeRects(xPos, pipes->column<PIPE_OPENING_Y>()[index], topRect, bottomRect);
+        SDL_Color green = {0, 255, 0, 255};
+        drawFillRect(renderer, green, topRect, RENDER_LAYER_PIPES);
+        drawFillRect(renderer, green, bottomRect, RENDER_LAYER_PIPES);
     });
 
     return node;
@@ -46,39 +78,67 @@ NodePtr PipePair(float initialX, float topPipeOpeningY) {
 //------------------------------------------------------------------------------
 // Pipe Manager Component
 //------------------------------------------------------------------------------
+// Enough for every pipe that can be on screen at once, so steady play never builds a node.
+constexpr size_t PIPE_RECYCLE_CAPACITY = 4;
+
 NodePtr Pipes(
-    State<GameStatus> gameStatus,
     Prop<SDL_FRect> birdRect,  // Pipes reads this
     State<int> score
 ) {
     auto node = createNode();
-    auto activePipes = node->state(std::deque<NodePtr>{});
+    node->setProfileLabel("Pipes");
+    auto gameStatus = node->use<GameStatus>();
+    auto pipes = node->batch<float, float, float, uint8_t, ColliderId, ColliderId>();
+    auto world = std::make_shared<CollisionWorld>(*node, PIPE_WIDTH * 2);
+    ColliderId birdCollider = world->add(val(birdRect), COLLIDE_BIRD, COLLIDE_PIPE);
     auto spawnTimer = PIPE_SPAWN_INTERVAL;
 
     std::random_device rd;
-    std::mt19937 gen(rd());
+    std::minstd_rand gen(rd());  // A few bytes of state, so the update closure stays pooled
     std::uniform_int_distribution<> distrib(0, MAX_PIPE_HEIGHT_OFFSET);
 
+    node->AddChild(For(
+        pipes->ids(),
+        [](BatchId id) { return id; },
+        [pipes](State<BatchId> id) { return PipePair(pipes, id); },
+        PIPE_RECYCLE_CAPACITY
+    ));
+
+    // Any contact is the bird hitting a pipe
     node->effect(
-        [activePipes, spawnTimer, node_ptr = node.get(), gameStatus]() mutable {
+        [world, gameStatus]() mutable {
+            if (!world->contacts().get().empty() && gameStatus.get() == GameStatus::Playing) {
+                gameStatus.set(GameStatus::GameOver);
+            }
+        },
+        world->contacts()
+    );
+
+    node->trackedEffect(
+        [pipes, world, spawnTimer, gameStatus]() mutable {
             GameStatus currentStatus = gameStatus.get();
             if (currentStatus != GameStatus::Playing) {
-                // Clear pipes and reset spawn timer if not playing
-                auto& pipes = activePipes.getRef();
-                if (!pipes.empty()) {
-                    pipes.clear();
-                    node_ptr->SetChildren({});  // Clear children from the node
+                // Clear pipes and reset spawn timer if not playing; the list drops their nodes
+                for (BatchId id : pipes->ids().peek()) {
+                    world->remove(pipes->at<PIPE_TOP_COLLIDER>(id));
+                    world->remove(pipes->at<PIPE_BOTTOM_COLLIDER>(id));
                 }
+                pipes->clear();
                 spawnTimer = PIPE_SPAWN_INTERVAL;  // Reset spawn timer
             }
-        },
-        gameStatus  // Dependency for the effect
+        }
     );
 
     node->update(
-        [activePipes, spawnTimer, node_ptr = node.get(), distrib, gen, gameStatus, birdRect, score](
-            double dt
-        ) mutable {
+        [pipes,
+         world,
+         birdCollider,
+         spawnTimer,
+         distrib,
+         gen,
+         gameStatus,
+         birdRect,
+         score](double dt) mutable {
             GameStatus currentStatus = gameStatus.get();
 
             if (currentStatus != GameStatus::Playing) {
@@ -90,61 +150,64 @@ NodePtr Pipes(
 
             if (spawnTimer <= 0) {
                 float topPipeOpeningY = static_cast<float>(MIN_PIPE_HEIGHT + distrib(gen));
-                NodePtr newPipe = PipePair(WINDOW_WIDTH + PIPE_WIDTH / 2, topPipeOpeningY);
-                activePipes.getRef().push_back(newPipe);
-                node_ptr->AddChild(newPipe);  // Add new pipe as a child of Pipes
+                float xPos = WINDOW_WIDTH + PIPE_WIDTH / 2;
+                SDL_FRect topRect;
+                SDL_FRect bottomRect;
+                pipeRects(xPos, topPipeOpeningY, topRect, bottomRect);
+                pipes->add(
+                    xPos,
+                    xPos,
+                    topPipeOpeningY,
+                    uint8_t{0},
+                    world->add(topRect, COLLIDE_PIPE, COLLIDE_BIRD),
+                    world->add(bottomRect, COLLIDE_PIPE, COLLIDE_BIRD)
+                );
                 spawnTimer = PIPE_SPAWN_INTERVAL;
             }
 
-            auto& pipes = activePipes.getRef();
+            // Move every pipe in one pass over the x column, keeping where it was for render
+            std::span<float> xs = pipes->column<PIPE_X>();
+            std::span<float> prevXs = pipes->column<PIPE_PREV_X>();
+            const float step = PIPE_SPEED * static_cast<float>(dt);
+            for (size_t i = 0; i < xs.size(); ++i) {
+                prevXs[i] = xs[i];
+                xs[i] -= step;
+            }
 
+            std::span<const float> openings = pipes->column<PIPE_OPENING_Y>();
+            std::span<uint8_t> scored = pipes->column<PIPE_SCORED>();
+            std::span<const ColliderId> topColliders = pipes->column<PIPE_TOP_COLLIDER>();
+            std::span<const ColliderId> bottomColliders = pipes->column<PIPE_BOTTOM_COLLIDER>();
             auto currentBirdRect = val(birdRect);
 
-            for (size_t i = 0; i < pipes.size(); ++i) {
-                NodePtr pipeNode = pipes[i];
-                // getStateSlot returns a shared_ptr to the TypedStateSlot
-                auto pipeDataStateSlotPtr = pipeNode->getStateSlot<PipeData>();
-                if (!pipeDataStateSlotPtr) {  // Check if the slot exists
-                    continue;
-                }
-
-                PipeData currentData = pipeDataStateSlotPtr->value;  // Make a copy to modify
-                currentData.xPos -= PIPE_SPEED * static_cast<float>(dt);
-                currentData.topRect.x = currentData.xPos - PIPE_WIDTH / 2;
-                currentData.bottomRect.x = currentData.xPos - PIPE_WIDTH / 2;
-
-                // Collision Check
-                if (SDL_HasRectIntersectionFloat(&currentBirdRect, &currentData.topRect) ||
-                    SDL_HasRectIntersectionFloat(&currentBirdRect, &currentData.bottomRect)) {
-                    // gameStatus.set will trigger the effect if status changes
-                    gameStatus.set(GameStatus::GameOver);
-                    // No need to check currentStatus == Playing again, as we returned if not
-                    // playing
-                }
+            for (size_t i = 0; i < xs.size(); ++i) {
+                SDL_FRect topRect;
+                SDL_FRect bottomRect;
+                pipeRects(xs[i], openings[i], topRect, bottomRect);
+                world->setRect(topColliders[i], topRect);
+                world->setRect(bottomColliders[i], bottomRect);
 
                 // Score Check
-                if (!currentData.scored && currentData.xPos < currentBirdRect.x) {
-                    currentData.scored = true;
+                if (!scored[i] && xs[i] < currentBirdRect.x) {
+                    scored[i] = 1;
                     score.set(score.get() + 1);
                 }
-                pipeDataStateSlotPtr->value = currentData;  // Update the pipe's state
             }
 
-            // Remove off-screen pipes
-            if (!pipes.empty()) {
-                NodePtr pipeToRemoveNode = pipes.front();
-                auto firstPipeDataStateSlotPtr = pipeToRemoveNode->getStateSlot<PipeData>();
-                if (firstPipeDataStateSlotPtr &&
-                    firstPipeDataStateSlotPtr->value.xPos < -PIPE_WIDTH) {
-                    pipes.pop_front();
-                    // Remove the child from the node's children list
-                    auto& children = node_ptr->children;
-                    children.erase(
-                        std::remove(children.begin(), children.end(), pipeToRemoveNode),
-                        children.end()
-                    );
+            // Remove off-screen pipes. Backwards, since removal moves the last entry into the gap
+            for (size_t i = xs.size(); i-- > 0;) {
+                if (xs[i] < -PIPE_WIDTH) {
+                    world->remove(topColliders[i]);
+                    world->remove(bottomColliders[i]);
+                    pipes->remove(pipes->ids().get()[i]);
                 }
             }
+
+            // The contacts effect turns a hit into GameOver
+            world->setRect(birdCollider, currentBirdRect);
+            world->step();
+
+            pipes->markChanged();  // Let the pipes' dependents know
         }
     );
     return node;
@@ -1,8 +1,8 @@
 #pragma once
 #include "game.hpp"
 
+// Uses the provided GameStatus.
 NodePtr Pipes(
-    State<GameStatus> gameStatus,
     Prop<SDL_FRect> birdRect,  // Pipes reads this
     State<int> score
 );
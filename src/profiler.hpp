@@ -0,0 +1,362 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Set to 1 to build the engine with profiling instrumentation. At 0 the FRP_PROFILE_* macros
+// expand to nothing and the Profiling functions are empty inlines, so nothing is measured.
+#ifndef FRP_PROFILE
+#define FRP_PROFILE 0
+#endif
+
+//------------------------------------------------------------------------------
+// Profiling
+//------------------------------------------------------------------------------
+namespace Profiling {
+enum class Phase : uint8_t { Update, Settle, Render, Event, Count };
+enum class Hook : uint8_t { Update, Render, Event, Effect, Count };
+enum class Counter : uint8_t { EffectRuns, DerivedRuns, StateWrites, Allocations, Count };
+
+constexpr size_t PHASE_COUNT = static_cast<size_t>(Phase::Count);
+constexpr size_t HOOK_COUNT = static_cast<size_t>(Hook::Count);
+constexpr size_t COUNTER_COUNT = static_cast<size_t>(Counter::Count);
+
+inline const char* phaseName(Phase phase) {
+    static const char* const names[PHASE_COUNT] = {"update", "settle", "render", "event"};
+    return names[static_cast<size_t>(phase)];
+}
+
+inline const char* hookName(Hook hook) {
+    static const char* const names[HOOK_COUNT] = {"update", "render", "event", "effect"};
+    return names[static_cast<size_t>(hook)];
+}
+
+// Time spent in one node's hooks over a frame.
+struct NodeTiming {
+    const void* node = nullptr;
+    const char* label = nullptr;  // Node::setProfileLabel, if set
+    double hookMs[HOOK_COUNT] = {};
+    uint32_t hookCalls[HOOK_COUNT] = {};
+
+    double totalMs() const {
+        double total = 0.0;
+        for (double ms : hookMs) {
+            total += ms;
+        }
+        return total;
+    }
+};
+
+// A finished frame. Allocations are the engine's own (pooled nodes, slots and hooks) and are
+// attributed to whichever phase was running.
+struct FrameStats {
+    uint64_t frame = 0;
+    double phaseMs[PHASE_COUNT] = {};
+    uint64_t phaseAllocations[PHASE_COUNT] = {};
+    uint64_t counters[COUNTER_COUNT] = {};
+    std::vector<NodeTiming> nodes;  // Slowest first
+
+    double ms(Phase phase) const {
+        return phaseMs[static_cast<size_t>(phase)];
+    }
+
+    uint64_t count(Counter counter) const {
+        return counters[static_cast<size_t>(counter)];
+    }
+};
+
+#if FRP_PROFILE
+using Clock = std::chrono::steady_clock;
+
+// Gathers the current frame and keeps the last finished one. Phases and hook timings are only
+// recorded on the thread that created the profiler (the main thread); hooks running on pool
+// workers are covered by their phase instead. Counters are atomic and count from any thread.
+class Profiler {
+  public:
+    static Profiler& instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    bool onMainThread() const {
+        return std::this_thread::get_id() == _mainThread;
+    }
+
+    void beginPhase(Phase phase) {
+        _currentPhase.store(static_cast<int>(phase), std::memory_order_relaxed);
+    }
+
+    void endPhase(Phase phase, Clock::time_point start, Clock::time_point end) {
+        _phaseMs[static_cast<size_t>(phase)] += toMs(end - start);
+        _currentPhase.store(-1, std::memory_order_relaxed);
+        trace(phaseName(phase), "phase", start, end);
+    }
+
+    void recordHook(
+        const void* node,
+        const char* label,
+        Hook hook,
+        Clock::time_point start,
+        Clock::time_point end
+    ) {
+        auto [slot, inserted] = _nodeIndex.try_emplace(node, _nodes.size());
+        if (inserted) {
+            _nodes.push_back({node, label});
+        }
+        NodeTiming& timing = _nodes[slot->second];
+        timing.hookMs[static_cast<size_t>(hook)] += toMs(end - start);
+        ++timing.hookCalls[static_cast<size_t>(hook)];
+        if (_tracing) {
+            trace(label ? label : hookName(hook), hookName(hook), start, end);
+        }
+    }
+
+    void count(Counter counter) {
+        _counters[static_cast<size_t>(counter)].fetch_add(1, std::memory_order_relaxed);
+        if (counter == Counter::Allocations) {
+            int phase = _currentPhase.load(std::memory_order_relaxed);
+            if (phase >= 0) {
+                _phaseAllocations[phase].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Publishes the frame gathered so far as lastFrame() and starts the next one.
+    void endFrame() {
+        FrameStats& done = _lastFrame;
+        done.frame = _frame++;
+        for (size_t i = 0; i < PHASE_COUNT; ++i) {
+            done.phaseMs[i] = std::exchange(_phaseMs[i], 0.0);
+            done.phaseAllocations[i] = _phaseAllocations[i].exchange(0, std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+            done.counters[i] = _counters[i].exchange(0, std::memory_order_relaxed);
+        }
+        std::sort(_nodes.begin(), _nodes.end(), [](const NodeTiming& a, const NodeTiming& b) {
+            return a.totalMs() > b.totalMs();
+        });
+        done.nodes.swap(_nodes);
+        _nodes.clear();
+        _nodeIndex.clear();
+        if (_tracing && _traceEvents.size() < MAX_TRACE_EVENTS) {
+            _traceEvents.push_back({"frame", "frame", toUs(Clock::now() - _epoch), 0.0, true});
+        }
+    }
+
+    const FrameStats& lastFrame() const {
+        return _lastFrame;
+    }
+
+    // Starts collecting phases and hook calls as trace events, dropping any earlier capture.
+    void startTrace() {
+        _traceEvents.clear();
+        _tracing = true;
+    }
+
+    bool tracing() const {
+        return _tracing;
+    }
+
+    // Stops the capture and writes it as Chrome trace JSON (chrome://tracing, Perfetto, or
+    // Tracy through its import-chrome tool). Returns false if the file couldn't be written.
+    bool stopTrace(const char* path) {
+        _tracing = false;
+        FILE* file = std::fopen(path, "w");
+        if (!file) {
+            return false;
+        }
+        std::fputs("{\"traceEvents\":[\n", file);
+        for (size_t i = 0; i < _traceEvents.size(); ++i) {
+            const TraceEvent& event = _traceEvents[i];
+            std::fputs("{\"name\":\"", file);
+            writeEscaped(file, event.name);
+            std::fprintf(file, "\",\"cat\":\"%s\",\"pid\":1,\"tid\":1,", event.category);
+            if (event.instant) {
+                std::fprintf(file, "\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f}", event.startUs);
+            } else {
+                std::fprintf(
+                    file, "\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f}", event.startUs, event.durationUs
+                );
+            }
+            std::fputs(i + 1 < _traceEvents.size() ? ",\n" : "\n", file);
+        }
+        std::fputs("]}\n", file);
+        _traceEvents.clear();
+        return std::fclose(file) == 0;
+    }
+
+  private:
+    struct TraceEvent {
+        const char* name;
+        const char* category;
+        double startUs;
+        double durationUs;
+        bool instant = false;
+    };
+
+    // Keeps a forgotten capture from eating all memory; later events are dropped.
+    static constexpr size_t MAX_TRACE_EVENTS = 1 << 22;
+
+    std::thread::id _mainThread = std::this_thread::get_id();
+    Clock::time_point _epoch = Clock::now();
+    uint64_t _frame = 0;
+    double _phaseMs[PHASE_COUNT] = {};
+    std::atomic<uint64_t> _phaseAllocations[PHASE_COUNT] = {};
+    std::atomic<uint64_t> _counters[COUNTER_COUNT] = {};
+    std::atomic<int> _currentPhase{-1};
+    std::vector<NodeTiming> _nodes;
+    std::unordered_map<const void*, size_t> _nodeIndex;
+    FrameStats _lastFrame;
+    bool _tracing = false;
+    std::vector<TraceEvent> _traceEvents;
+
+    static double toMs(Clock::duration duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    double toUs(Clock::duration duration) const {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    }
+
+    void trace(
+        const char* name,
+        const char* category,
+        Clock::time_point start,
+        Clock::time_point end
+    ) {
+        if (_tracing && _traceEvents.size() < MAX_TRACE_EVENTS) {
+            _traceEvents.push_back({name, category, toUs(start - _epoch), toUs(end - start)});
+        }
+    }
+
+    static void writeEscaped(FILE* file, const char* text) {
+        for (; *text; ++text) {
+            if (*text == '"' || *text == '\\') {
+                std::fputc('\\', file);
+            }
+            if (static_cast<unsigned char>(*text) >= 0x20) {
+                std::fputc(*text, file);
+            }
+        }
+    }
+};
+
+class PhaseScope {
+  public:
+    explicit PhaseScope(Phase phase) : _phase(phase), _active(Profiler::instance().onMainThread()) {
+        if (_active) {
+            Profiler::instance().beginPhase(phase);
+            _start = Clock::now();
+        }
+    }
+
+    ~PhaseScope() {
+        if (_active) {
+            Profiler::instance().endPhase(_phase, _start, Clock::now());
+        }
+    }
+
+    PhaseScope(const PhaseScope&) = delete;
+    PhaseScope& operator=(const PhaseScope&) = delete;
+
+  private:
+    Phase _phase;
+    bool _active;
+    Clock::time_point _start;
+};
+
+class HookScope {
+  public:
+    HookScope(const void* node, const char* label, Hook hook)
+        : _node(node)
+        , _label(label)
+        , _hook(hook)
+        , _active(Profiler::instance().onMainThread()) {
+        if (_active) {
+            _start = Clock::now();
+        }
+    }
+
+    ~HookScope() {
+        if (_active) {
+            Profiler::instance().recordHook(_node, _label, _hook, _start, Clock::now());
+        }
+    }
+
+    HookScope(const HookScope&) = delete;
+    HookScope& operator=(const HookScope&) = delete;
+
+  private:
+    const void* _node;
+    const char* _label;
+    Hook _hook;
+    bool _active;
+    Clock::time_point _start;
+};
+
+inline void endFrame() {
+    Profiler::instance().endFrame();
+}
+
+inline const FrameStats& lastFrame() {
+    return Profiler::instance().lastFrame();
+}
+
+inline void startTrace() {
+    Profiler::instance().startTrace();
+}
+
+inline bool tracing() {
+    return Profiler::instance().tracing();
+}
+
+inline bool stopTrace(const char* path) {
+    return Profiler::instance().stopTrace(path);
+}
+#else
+inline void endFrame() {
+}
+
+inline const FrameStats& lastFrame() {
+    static const FrameStats empty;
+    return empty;
+}
+
+inline void startTrace() {
+}
+
+inline bool tracing() {
+    return false;
+}
+
+inline bool stopTrace(const char*) {
+    return false;
+}
+#endif
+}  // namespace Profiling
+
+#if FRP_PROFILE
+#define FRP_PROFILE_CONCAT_(a, b) a##b
+#define FRP_PROFILE_CONCAT(a, b) FRP_PROFILE_CONCAT_(a, b)
+// Times the rest of the enclosing scope as `phase`.
+#define FRP_PROFILE_PHASE(phase) \
+    ::Profiling::PhaseScope FRP_PROFILE_CONCAT(profilePhase, __LINE__)(::Profiling::Phase::phase)
+// Times the rest of the enclosing scope as one `hook` call on `node`.
+#define FRP_PROFILE_HOOK(node, label, hook) \
+    ::Profiling::HookScope FRP_PROFILE_CONCAT(profileHook, __LINE__)( \
+        node, label, ::Profiling::Hook::hook \
+    )
+#define FRP_PROFILE_COUNT(counter) \
+    ::Profiling::Profiler::instance().count(::Profiling::Counter::counter)
+#else
+#define FRP_PROFILE_PHASE(phase)
+#define FRP_PROFILE_HOOK(node, label, hook)
+#define FRP_PROFILE_COUNT(counter)
+#endif
@@ -1,60 +1,428 @@
 #include "text.hpp"
 
+#include <algorithm>
+#include <memory>
+#include <vector>
+
 //------------------------------------------------------------------------------
-// Text Component
+// Cached Label Textures
 //------------------------------------------------------------------------------
-NodePtr Text(
-    Prop<TTF_Font*> font,       // Font to use for rendering
-    Prop<SDL_Color> color,      // Color of the text
-    Prop<std::string> text,     // Flexible text property
-    Prop<SDL_FPoint> position,  // Flexible position property
-    Prop<bool> isVisible
-) {
-    auto node = createNode();
+// Every live label, so that closing a font can drop what was rendered with it.
+static std::vector<LabelTexture*>& liveLabels() {
+    static std::vector<LabelTexture*> labels;
+    return labels;
+}
 
-    node->render([font, color, text, position, isVisible](SDL_Renderer* renderer) {
-        if (!val(isVisible)) {
-            return;
+// Owns the rasterized texture of a single label. It is rebuilt only when the font, color or
+// string differs from the ones it was last rendered with, so a constant label uploads once.
+class LabelTexture {
+  public:
+    LabelTexture() {
+        liveLabels().push_back(this);
+    }
+    LabelTexture(const LabelTexture&) = delete;
+    LabelTexture& operator=(const LabelTexture&) = delete;
+
+    ~LabelTexture() {
+        release();
+        auto& labels = liveLabels();
+        auto it = std::find(labels.begin(), labels.end(), this);
+        *it = labels.back();
+        labels.pop_back();
+    }
+
+    // Called before `font` is closed: a font opened later at the same address must not match.
+    void forgetFont(TTF_Font* font) {
+        if (_font == font) {
+            release();
+            _font = nullptr;
         }
+    }
 
-        if (val(text).empty()) {
+    void draw(
+        SDL_Renderer* renderer,
+        TTF_Font* font,
+        const std::string& text,
+        SDL_Color color,
+        SDL_FPoint position
+    ) {
+        if (!matches(renderer, font, text, color) && !rasterize(renderer, font, text, color)) {
             return;
         }
 
-        auto currentPosition = val(position);
+        SDL_FRect dstRect = {position.x - _width / 2.0f, position.y, _width, _height};
+        drawTexture(renderer, _texture, nullptr, dstRect, RENDER_LAYER_UI);
+    }
+
+  private:
+    SDL_Texture* _texture = nullptr;
+    SDL_Renderer* _renderer = nullptr;
+    TTF_Font* _font = nullptr;
+    SDL_Color _color = {};
+    std::string _text;
+    float _width = 0.0f;
+    float _height = 0.0f;
+
+    bool matches(
+        SDL_Renderer* renderer,
+        TTF_Font* font,
+        const std::string& text,
+        SDL_Color color
+    ) const {
+        return _texture && _renderer == renderer && _font == font && _color.r == color.r &&
+               _color.g == color.g && _color.b == color.b && _color.a == color.a &&
+               _text == text;
+    }
 
-        SDL_Surface* surface =
-            TTF_RenderText_Solid(val(font), val(text).c_str(), val(text).length(), val(color));
+    bool rasterize(
+        SDL_Renderer* renderer,
+        TTF_Font* font,
+        const std::string& text,
+        SDL_Color color
+    ) {
+        release();
+
+        SDL_Surface* surface = TTF_RenderText_Solid(font, text.c_str(), text.length(), color);
         if (!surface) {
             SDL_LogWarn(
                 SDL_LOG_CATEGORY_APPLICATION,
                 "TTF_RenderText_Solid failed: %s",
                 SDL_GetError()
             );
-            return;
+            return false;
         }
 
-        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-        if (!texture) {
+        _texture = SDL_CreateTextureFromSurface(renderer, surface);
+        _width = static_cast<float>(surface->w);
+        _height = static_cast<float>(surface->h);
+        SDL_DestroySurface(surface);
+        if (!_texture) {
             SDL_LogWarn(
                 SDL_LOG_CATEGORY_APPLICATION,
                 "SDL_CreateTextureFromSurface failed: %s",
                 SDL_GetError()
             );
-            SDL_DestroySurface(surface);
+            return false;
+        }
+
+        _renderer = renderer;
+        _font = font;
+        _color = color;
+        _text = text;
+        return true;
+    }
+
+    void release() {
+        if (_texture) {
+            SDL_DestroyTexture(_texture);
+            _texture = nullptr;
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Glyph Atlas
+//------------------------------------------------------------------------------
+// One atlas per (renderer, font, color). Glyphs are rasterized the first time they are drawn and
+// packed into shelves of a single texture, so a string that changes every few frames (a score
+// counter) is composed from cached glyphs in one geometry call instead of re-rasterized.
+class GlyphAtlas {
+  public:
+    static constexpr int SIZE = 512;
+
+    GlyphAtlas(SDL_Renderer* renderer, TTF_Font* font, SDL_Color color)
+        : renderer(renderer)
+        , font(font)
+        , color(color) {
+        _surface = SDL_CreateSurface(SIZE, SIZE, SDL_PIXELFORMAT_RGBA32);
+        _texture = SDL_CreateTexture(
+            renderer,
+            SDL_PIXELFORMAT_RGBA32,
+            SDL_TEXTUREACCESS_STATIC,
+            SIZE,
+            SIZE
+        );
+        if (!_surface || !_texture) {
+            SDL_LogWarn(
+                SDL_LOG_CATEGORY_APPLICATION,
+                "Failed to create glyph atlas: %s",
+                SDL_GetError()
+            );
             return;
         }
+        SDL_ClearSurface(_surface, 0.0f, 0.0f, 0.0f, 0.0f);
+        SDL_SetTextureBlendMode(_texture, SDL_BLENDMODE_BLEND);
+    }
 
-        SDL_FRect dstRect;
-        dstRect.w = static_cast<float>(surface->w);
-        dstRect.h = static_cast<float>(surface->h);
-        dstRect.x = currentPosition.x - dstRect.w / 2.0f;
-        dstRect.y = currentPosition.y;
+    GlyphAtlas(const GlyphAtlas&) = delete;
+    GlyphAtlas& operator=(const GlyphAtlas&) = delete;
 
-        SDL_RenderTexture(renderer, texture, nullptr, &dstRect);
-        SDL_DestroyTexture(texture);
-        SDL_DestroySurface(surface);
-    });
+    ~GlyphAtlas() {
+        if (_texture) {
+            SDL_DestroyTexture(_texture);
+        }
+        if (_surface) {
+            SDL_DestroySurface(_surface);
+        }
+    }
+
+    SDL_Renderer* const renderer;
+    TTF_Font* const font;
+    const SDL_Color color;
+
+    bool matches(SDL_Renderer* r, TTF_Font* f, SDL_Color c) const {
+        return renderer == r && font == f && color.r == c.r && color.g == c.g &&
+               color.b == c.b && color.a == c.a;
+    }
+
+    // Draws the string centered on position.x. Returns false if a glyph couldn't be placed, in
+    // which case nothing was drawn and the caller should fall back to a label texture.
+    bool draw(const std::string& text, SDL_FPoint position) {
+        if (!_surface || !_texture) {
+            return false;
+        }
+
+        _quads.clear();
+        float penX = 0.0f;
+        Uint32 previous = 0;
+        for (size_t offset = 0; offset < text.size();) {
+            Uint32 codepoint = decodeUtf8(text, offset);
+            const Glyph* glyph = find(codepoint);
+            if (!glyph) {
+                return false;
+            }
+            int kerning = 0;
+            if (previous && TTF_GetGlyphKerning(font, previous, codepoint, &kerning)) {
+                penX += static_cast<float>(kerning);
+            }
+            if (glyph->rect.w > 0) {
+                _quads.push_back({penX, glyph->rect});
+            }
+            penX += static_cast<float>(glyph->advance);
+            previous = codepoint;
+        }
+
+        float originX = position.x - penX / 2.0f;
+        _vertices.clear();
+        _indices.clear();
+        for (const auto& quad : _quads) {
+            const SDL_Rect& src = quad.source;
+            float x0 = originX + quad.x;
+            float y0 = position.y;
+            float x1 = x0 + static_cast<float>(src.w);
+            float y1 = y0 + static_cast<float>(src.h);
+            float u0 = static_cast<float>(src.x) / SIZE;
+            float v0 = static_cast<float>(src.y) / SIZE;
+            float u1 = static_cast<float>(src.x + src.w) / SIZE;
+            float v1 = static_cast<float>(src.y + src.h) / SIZE;
+
+            int base = static_cast<int>(_vertices.size());
+            SDL_FColor white = {1.0f, 1.0f, 1.0f, 1.0f};
+            _vertices.push_back({{x0, y0}, white, {u0, v0}});
+            _vertices.push_back({{x1, y0}, white, {u1, v0}});
+            _vertices.push_back({{x1, y1}, white, {u1, v1}});
+            _vertices.push_back({{x0, y1}, white, {u0, v1}});
+            for (int index : {0, 1, 2, 0, 2, 3}) {
+                _indices.push_back(base + index);
+            }
+        }
+
+        if (!_vertices.empty()) {
+            drawGeometry(
+                renderer,
+                _texture,
+                _vertices.data(),
+                static_cast<int>(_vertices.size()),
+                _indices.data(),
+                static_cast<int>(_indices.size()),
+                RENDER_LAYER_UI
+            );
+        }
+        return true;
+    }
+
+  private:
+    struct Glyph {
+        Uint32 codepoint;
+        SDL_Rect rect;  // Area of the atlas, empty for whitespace
+        int advance;
+    };
+
+    // Copies the glyph rect, since inserting a later glyph may move _glyphs
+    struct Quad {
+        float x;
+        SDL_Rect source;
+    };
+
+    SDL_Surface* _surface = nullptr;
+    SDL_Texture* _texture = nullptr;
+    std::vector<Glyph> _glyphs;  // Sorted by codepoint
+    int _shelfX = 0;
+    int _shelfY = 0;
+    int _shelfHeight = 0;
+
+    // Per-draw scratch, kept to avoid reallocating every frame
+    std::vector<Quad> _quads;
+    std::vector<SDL_Vertex> _vertices;
+    std::vector<int> _indices;
+
+    static Uint32 decodeUtf8(const std::string& text, size_t& offset) {
+        auto byte = [&](size_t i) { return static_cast<Uint32>(static_cast<Uint8>(text[i])); };
+        Uint32 lead = byte(offset);
+        size_t length = lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+        if (offset + length > text.size()) {
+            offset = text.size();
+            return 0xFFFD;
+        }
+        Uint32 codepoint = length == 1   ? lead
+                           : length == 2 ? lead & 0x1F
+                           : length == 3 ? lead & 0x0F
+                                         : lead & 0x07;
+        for (size_t i = 1; i < length; ++i) {
+            codepoint = (codepoint << 6) | (byte(offset + i) & 0x3F);
+        }
+        offset += length;
+        return codepoint;
+    }
+
+    const Glyph* find(Uint32 codepoint) {
+        auto it = std::lower_bound(
+            _glyphs.begin(),
+            _glyphs.end(),
+            codepoint,
+            [](const Glyph& glyph, Uint32 value) { return glyph.codepoint < value; }
+        );
+        if (it != _glyphs.end() && it->codepoint == codepoint) {
+            return &*it;
+        }
+
+        Glyph glyph = {codepoint, {0, 0, 0, 0}, 0};
+        if (!rasterize(glyph)) {
+            return nullptr;
+        }
+        return &*_glyphs.insert(it, glyph);
+    }
+
+    bool rasterize(Glyph& glyph) {
+        if (!TTF_GetGlyphMetrics(
+                font,
+                glyph.codepoint,
+                nullptr,
+                nullptr,
+                nullptr,
+                nullptr,
+                &glyph.advance
+            )) {
+            return false;
+        }
+
+        SDL_Surface* rendered = TTF_RenderGlyph_Solid(font, glyph.codepoint, color);
+        if (!rendered) {
+            // Whitespace has no pixels, only an advance
+            return true;
+        }
+
+        if (_shelfX + rendered->w > SIZE) {
+            _shelfX = 0;
+            _shelfY += _shelfHeight + 1;
+            _shelfHeight = 0;
+        }
+        if (rendered->w > SIZE || _shelfY + rendered->h > SIZE) {
+            SDL_DestroySurface(rendered);
+            return false;
+        }
+
+        glyph.rect = {_shelfX, _shelfY, rendered->w, rendered->h};
+        SDL_SetSurfaceBlendMode(rendered, SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(rendered, nullptr, _surface, &glyph.rect);
+        SDL_DestroySurface(rendered);
+
+        const auto* pixels = static_cast<const Uint8*>(_surface->pixels);
+        SDL_UpdateTexture(
+            _texture,
+            &glyph.rect,
+            pixels + glyph.rect.y * _surface->pitch + glyph.rect.x * 4,
+            _surface->pitch
+        );
+
+        _shelfX += glyph.rect.w + 1;
+        _shelfHeight = std::max(_shelfHeight, glyph.rect.h);
+        return true;
+    }
+};
+
+static std::vector<std::unique_ptr<GlyphAtlas>>& glyphAtlases() {
+    static std::vector<std::unique_ptr<GlyphAtlas>> atlases;
+    return atlases;
+}
+
+static GlyphAtlas& glyphAtlasFor(SDL_Renderer* renderer, TTF_Font* font, SDL_Color color) {
+    auto& atlases = glyphAtlases();
+    for (auto& atlas : atlases) {
+        if (atlas->matches(renderer, font, color)) {
+            return *atlas;
+        }
+    }
+    return *atlases.emplace_back(std::make_unique<GlyphAtlas>(renderer, font, color));
+}
+
+void ReleaseTextCaches() {
+    glyphAtlases().clear();
+}
+
+//------------------------------------------------------------------------------
+// Text Drawing
+//------------------------------------------------------------------------------
+std::shared_ptr<LabelTexture> Detail::makeLabelTexture() {
+    return std::make_shared<LabelTexture>();
+}
+
+void Detail::drawText(
+    SDL_Renderer* renderer,
+    LabelTexture& label,
+    TTF_Font* font,
+    const std::string& text,
+    SDL_Color color,
+    SDL_FPoint position,
+    bool useAtlas
+) {
+    if (useAtlas && glyphAtlasFor(renderer, font, color).draw(text, position)) {
+        return;
+    }
+    label.draw(renderer, font, text, color, position);
+}
+
+//------------------------------------------------------------------------------
+// Font Loading
+//------------------------------------------------------------------------------
+TTF_Font* ResourceLoader<TTF_Font>::load(const std::string& path, float pointSize) {
+    TTF_Font* font = TTF_OpenFont(path.c_str(), pointSize);
+    if (!font) {
+        SDL_LogWarn(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "Failed to load font '%s': %s. Text using it will not appear.",
+            path.c_str(),
+            SDL_GetError()
+        );
+    }
+    return font;
+}
+
+// The atlases and labels are keyed by the font pointer, so drop this font's entries first.
+void ResourceLoader<TTF_Font>::destroy(TTF_Font* font) {
+    if (!font) {
+        return;
+    }
+    std::erase_if(glyphAtlases(), [font](const auto& atlas) { return atlas->font == font; });
+    for (LabelTexture* label : liveLabels()) {
+        label->forgetFont(font);
+    }
+    TTF_CloseFont(font);
+}
 
-    return node;
+// Never handed out, so nothing was cached for it; may run on a worker.
+void ResourceLoader<TTF_Font>::discard(TTF_Font* font) {
+    if (font) {
+        TTF_CloseFont(font);
+    }
 }
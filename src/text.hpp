@@ -1,10 +1,119 @@
 #pragma once
 #include "game.hpp"
 
-NodePtr Text(
-    Prop<TTF_Font*> font,        // Font to use for rendering
-    Prop<SDL_Color> color,       // Color of the text
-    Prop<std::string> text,      // Flexible text property
-    Prop<SDL_FPoint> position,   // Flexible position property
-    Prop<bool> isVisible = true  // Flexible visibility, defaults to true
+class LabelTexture;
+
+namespace Detail {
+// Shared by every Text instantiation; defined in text.cpp.
+std::shared_ptr<LabelTexture> makeLabelTexture();
+
+// Draws one line centered on `position`. Strings that can change go through the shared glyph
+// atlas (`useAtlas`); constant ones, and any the atlas can't fit, use the label's own texture.
+void drawText(
+    SDL_Renderer* renderer,
+    LabelTexture& label,
+    TTF_Font* font,
+    const std::string& text,
+    SDL_Color color,
+    SDL_FPoint position,
+    bool useAtlas
 );
+
+template <
+    typename FontProp,
+    typename ColorProp,
+    typename TextProp,
+    typename PositionProp,
+    typename VisibleProp>
+NodePtr TextNode(
+    FontProp font,
+    ColorProp color,
+    TextProp text,
+    PositionProp position,
+    VisibleProp isVisible
+) {
+    auto node = createNode();
+    node->setProfileLabel("Text");
+
+    bool useAtlas = !isConstant(text);
+    auto label = makeLabelTexture();
+
+    auto renderFn = [font, color, text, position, isVisible, useAtlas, label](
+                        SDL_Renderer* renderer
+                    ) {
+        if (!val(isVisible)) {
+            return;
+        }
+        TTF_Font* currentFont = val(font);
+        if (!currentFont) {
+            return;
+        }
+
+        // Read the string in place rather than copying it out of the prop
+        withVal(text, [&](const std::string& currentText) {
+            if (!currentText.empty()) {
+                drawText(
+                    renderer,
+                    *label,
+                    currentFont,
+                    currentText,
+                    val(color),
+                    val(position),
+                    useAtlas
+                );
+            }
+        });
+    };
+
+    // Replay the recorded draw until a prop changes, unless one is computed and can't be tracked
+    if (isComputed(font) || isComputed(color) || isComputed(text) || isComputed(position) ||
+        isComputed(isVisible)) {
+        node->render(std::move(renderFn));
+    } else {
+        node->render(std::move(renderFn), font, color, text, position, isVisible);
+    }
+
+    return node;
+}
+}  // namespace Detail
+
+// Every prop may be a plain value, a callable, a ConstProp, State or FnProp, or a Prop<T>; see
+// asProp(). Typed arguments keep the kind in the instantiation, so reads are direct.
+template <
+    typename FontProp,
+    typename ColorProp,
+    typename TextProp,
+    typename PositionProp,
+    typename VisibleProp = bool>
+NodePtr Text(
+    FontProp&& font,                // Font to use for rendering
+    ColorProp&& color,              // Color of the text
+    TextProp&& text,                // Flexible text property
+    PositionProp&& position,        // Flexible position property
+    VisibleProp&& isVisible = true  // Flexible visibility, defaults to true
+) {
+    return Detail::TextNode(
+        asProp<TTF_Font*>(std::forward<FontProp>(font)),
+        asProp<SDL_Color>(std::forward<ColorProp>(color)),
+        asProp<std::string>(std::forward<TextProp>(text)),
+        asProp<SDL_FPoint>(std::forward<PositionProp>(position)),
+        asProp<bool>(std::forward<VisibleProp>(isVisible))
+    );
+}
+
+// Frees the shared glyph atlases. Call before destroying the renderer they were created on.
+void ReleaseTextCaches();
+
+// Fonts for Node::resource<TTF_Font>(path, size), opened on the worker: TTF_OpenFont is
+// safe to call from any thread in SDL_ttf 3. Defined in text.cpp.
+template <>
+struct ResourceLoader<TTF_Font> {
+    using Staged = TTF_Font*;
+
+    static TTF_Font* load(const std::string& path, float pointSize);
+    static TTF_Font* finish(TTF_Font* font, SDL_Renderer*) {
+        return font;
+    }
+    static void destroy(TTF_Font* font);  // Also flushes the text caches built with it
+    static void discard(TTF_Font* font);
+};
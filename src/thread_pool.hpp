@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// Work-Stealing Thread Pool
+//------------------------------------------------------------------------------
+// Fork-join pool for frame work. run() spreads a batch of tasks over per-worker queues, the
+// calling thread joins in as one more worker, and idle workers steal from the front of other
+// queues so that one heavy subtree doesn't leave the rest of the pool waiting. Workers that
+// aren't needed for a batch can also take background jobs (see post()).
+class WorkStealingPool {
+  public:
+    using Task = std::function<void()>;
+
+    explicit WorkStealingPool(unsigned threadCount = defaultThreadCount())
+        : _queues(threadCount + 1) {
+        _workers.reserve(threadCount);
+        for (unsigned i = 0; i < threadCount; ++i) {
+            _workers.emplace_back([this, i] { workerLoop(i + 1); });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard lock(_wakeMutex);
+            _stopping = true;
+        }
+        _wake.notify_all();
+        for (auto& worker : _workers) {
+            worker.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    static unsigned defaultThreadCount() {
+        unsigned cores = std::thread::hardware_concurrency();
+        return cores > 1 ? cores - 1 : 1;
+    }
+
+    unsigned threadCount() const {
+        return static_cast<unsigned>(_workers.size());
+    }
+
+    // Runs every task and returns once all of them have finished. The first exception thrown
+    // by a task is rethrown here after the batch has drained.
+    void run(std::vector<Task>& tasks) {
+        if (tasks.empty()) {
+            return;
+        }
+        if (tasks.size() == 1 || _workers.empty()) {
+            for (auto& task : tasks) {
+                task();
+            }
+            return;
+        }
+        _pending.store(tasks.size(), std::memory_order_relaxed);
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            Queue& queue = _queues[i % _queues.size()];
+            std::lock_guard lock(queue.mutex);
+            queue.tasks.push_back(&tasks[i]);
+        }
+        {
+            std::lock_guard lock(_wakeMutex);
+            ++_generation;
+        }
+        _wake.notify_all();
+
+        drain(0);
+        while (_pending.load(std::memory_order_acquire) > 0) {
+            if (!drain(0)) {
+                std::this_thread::yield();
+            }
+        }
+
+        std::exception_ptr failure;
+        {
+            std::lock_guard lock(_failureMutex);
+            failure = std::exchange(_failure, nullptr);
+        }
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+    // Queues a job to run on some worker outside any run() batch, for slow work like loading
+    // files. Workers prefer batch tasks, the thread calling run() never takes a job, and run()
+    // doesn't wait for them. Jobs still queued when the pool is destroyed are dropped; a job
+    // must not throw. Without workers the job runs on the caller, before post() returns.
+    void post(Task job) {
+        if (_workers.empty()) {
+            job();
+            return;
+        }
+        {
+            std::lock_guard lock(_wakeMutex);
+            _jobs.push_back(std::move(job));
+        }
+        _wake.notify_one();
+    }
+
+  private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task*> tasks;
+    };
+
+    std::vector<Queue> _queues;  // Index 0 belongs to the thread calling run()
+    std::vector<std::thread> _workers;
+    std::atomic<size_t> _pending{0};
+
+    std::mutex _wakeMutex;
+    std::condition_variable _wake;
+    uint64_t _generation = 0;
+    bool _stopping = false;
+    std::deque<Task> _jobs;  // post()ed, guarded by _wakeMutex
+
+    std::mutex _failureMutex;
+    std::exception_ptr _failure;
+
+    // Own queue from the back (most recently queued, still warm), others from the front.
+    Task* take(size_t self) {
+        {
+            Queue& own = _queues[self];
+            std::lock_guard lock(own.mutex);
+            if (!own.tasks.empty()) {
+                Task* task = own.tasks.back();
+                own.tasks.pop_back();
+                return task;
+            }
+        }
+        for (size_t offset = 1; offset < _queues.size(); ++offset) {
+            Queue& victim = _queues[(self + offset) % _queues.size()];
+            std::lock_guard lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                Task* task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    // Runs tasks until none are left to take. Returns whether it ran any.
+    bool drain(size_t self) {
+        bool ranAny = false;
+        while (Task* task = take(self)) {
+            ranAny = true;
+            try {
+                (*task)();
+            } catch (...) {
+                std::lock_guard lock(_failureMutex);
+                if (!_failure) {
+                    _failure = std::current_exception();
+                }
+            }
+            _pending.fetch_sub(1, std::memory_order_acq_rel);
+        }
+        return ranAny;
+    }
+
+    void workerLoop(size_t self) {
+        uint64_t seenGeneration = 0;
+        for (;;) {
+            Task job;
+            {
+                std::unique_lock lock(_wakeMutex);
+                _wake.wait(lock, [&] {
+                    return _stopping || _generation != seenGeneration || !_jobs.empty();
+                });
+                if (_stopping) {
+                    return;
+                }
+                if (_generation != seenGeneration) {
+                    seenGeneration = _generation;
+                } else {
+                    job = std::move(_jobs.front());
+                    _jobs.pop_front();
+                }
+            }
+            if (job) {
+                job();
+            } else {
+                drain(self);
+            }
+        }
+    }
+};